@@ -3,103 +3,687 @@
 
 #include <cstddef>
 
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <new>
 #include <stdexcept>
 #include <type_traits>
 #include <utility>
 
+#include "SharedPtr.hpp"
+
 namespace cs540 {
 class BadFunctionCall : public std::logic_error {
 public:
     BadFunctionCall() : logic_error{"bad function call"} {}
 };
 
+// Makes copies of a Function share one copy of its target.
+struct ShareTarget {};
+
+constexpr ShareTarget share_target {};
+
+// Identifies a type without RTTI, by the address of a variable of its own.
+using TypeId = const void *;
+
 namespace internal {
-template <typename R, typename... Args>
-class FunctionBase {
-protected:
-    constexpr FunctionBase() noexcept = default;
+template <typename T>
+struct TypeTag {
+    static char id;
+};
+
+template <typename T>
+char TypeTag<T>::id;
+}
+
+template <typename T>
+constexpr TypeId type_id() noexcept {
+    return &internal::TypeTag<std::remove_cv_t<T>>::id;
+}
+
+// Hands out memory from the caller's buffer, then from chunks that double in
+// size. Nothing is freed until reset() or destruction.
+class MonotonicArena {
+    struct _Chunk {
+        _Chunk *next;
+        std::size_t size;
+    };
+
+    char *const _initial;
+    const std::size_t _initial_size;
+    _Chunk *_chunks;
+    char *_cursor;
+    char *_end;
+    std::size_t _next_size;
+
+    void _grow(std::size_t min) {
+        auto size = std::max(_next_size, sizeof(_Chunk) + min);
+        auto chunk = static_cast<_Chunk *>(::operator new(size));
+        chunk->next = _chunks;
+        chunk->size = size;
+        _chunks = chunk;
+        _next_size = size * 2;
+        _rewind(chunk);
+    }
+
+    void _rewind(_Chunk *chunk) noexcept {
+        _cursor = reinterpret_cast<char *>(chunk + 1);
+        _end = reinterpret_cast<char *>(chunk) + chunk->size;
+    }
+
+    void _release() noexcept {
+        while (_chunks) {
+            auto next = _chunks->next;
+            ::operator delete(_chunks);
+            _chunks = next;
+        }
+    }
+
+public:
+    explicit MonotonicArena(std::size_t chunk_size = 4096) noexcept :
+        MonotonicArena{nullptr, 0, chunk_size} {}
+
+    MonotonicArena(void *buffer, std::size_t size, std::size_t chunk_size = 4096) noexcept :
+        _initial{static_cast<char *>(buffer)}, _initial_size{size}, _chunks{},
+        _cursor{_initial}, _end{_initial + size}, _next_size{chunk_size} {}
+
+    MonotonicArena(const MonotonicArena &) = delete;
+    MonotonicArena &operator=(const MonotonicArena &) = delete;
+
+    ~MonotonicArena() {
+        _release();
+    }
+
+    void *allocate(std::size_t size, std::size_t align) {
+        void *ptr = _cursor;
+        std::size_t space = _end - _cursor;
+        if (!std::align(align, size, ptr, space)) {
+            _grow(size + align);
+            ptr = _cursor;
+            space = _end - _cursor;
+            std::align(align, size, ptr, space);
+        }
+        _cursor = static_cast<char *>(ptr) + size;
+        return ptr;
+    }
+
+    // Everything allocated so far must already be destroyed. The newest,
+    // largest chunk is kept so that later allocations can reuse it.
+    void reset() noexcept {
+        if (auto last = _chunks) {
+            _chunks = last->next;
+            _release();
+            last->next = nullptr;
+            _chunks = last;
+            _rewind(last);
+        } else {
+            _cursor = _initial;
+            _end = _initial + _initial_size;
+        }
+    }
+}; // class MonotonicArena
+
+template <typename T>
+class ArenaAllocator {
+    template <typename>
+    friend class ArenaAllocator;
+
+    MonotonicArena *_arena;
 
 public:
-    FunctionBase(const FunctionBase &) = delete;
-    FunctionBase(FunctionBase &&) = delete;
-    FunctionBase &operator=(const FunctionBase &) = delete;
-    FunctionBase &operator=(FunctionBase &&) = delete;
+    using value_type = T;
+
+    constexpr explicit ArenaAllocator(MonotonicArena &arena) noexcept : _arena{&arena} {}
+
+    template <typename U>
+    constexpr ArenaAllocator(const ArenaAllocator<U> &that) noexcept : _arena{that._arena} {}
+
+    T *allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) throw std::bad_alloc {};
+        return static_cast<T *>(_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    // Memory is only given back by resetting the arena.
+    void deallocate(T *, std::size_t) noexcept {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &that) const noexcept {
+        return _arena == that._arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &that) const noexcept {
+        return _arena != that._arena;
+    }
+};
+
+namespace internal {
+// Room for up to three pointers' worth of captures, or a pointer to a larger target.
+using FunctionBuffer = std::aligned_storage_t<3 * sizeof(void *), alignof(void *)>;
+
+template <typename F>
+using FitsInline = std::integral_constant<bool,
+    sizeof(F) <= sizeof(FunctionBuffer) &&
+    alignof(FunctionBuffer) % alignof(F) == 0 &&
+    std::is_nothrow_move_constructible<F>::value>;
+
+template <typename F, bool = FitsInline<F>::value>
+struct Storage {
+    using Target = F;
+
+    static F &get(FunctionBuffer &buffer) noexcept {
+        return *reinterpret_cast<F *>(&buffer);
+    }
+
+    static const F &get(const FunctionBuffer &buffer) noexcept {
+        return *reinterpret_cast<const F *>(&buffer);
+    }
+
+    template <typename... Ts>
+    static void create(FunctionBuffer &buffer, Ts &&...args) {
+        new (&buffer) F(std::forward<Ts>(args)...);
+    }
+
+    static void clone(FunctionBuffer &to, const FunctionBuffer &from) {
+        create(to, get(from));
+    }
+
+    // Leaves from empty.
+    static void move(FunctionBuffer &to, FunctionBuffer &from) noexcept {
+        create(to, std::move(get(from)));
+        destroy(from);
+    }
+
+    static void destroy(FunctionBuffer &buffer) noexcept {
+        get(buffer).~F();
+    }
+};
+
+template <typename F>
+struct Storage<F, false> {
+    using Target = F;
 
-    virtual ~FunctionBase() = default;
-    virtual R operator()(Args...) = 0;
-    virtual std::unique_ptr<FunctionBase> clone() const = 0;
+    static F *&pointer(FunctionBuffer &buffer) noexcept {
+        return *reinterpret_cast<F **>(&buffer);
+    }
+
+    static F &get(FunctionBuffer &buffer) noexcept {
+        return *pointer(buffer);
+    }
+
+    static const F &get(const FunctionBuffer &buffer) noexcept {
+        return **reinterpret_cast<F *const *>(&buffer);
+    }
+
+    template <typename... Ts>
+    static void create(FunctionBuffer &buffer, Ts &&...args) {
+        pointer(buffer) = new F(std::forward<Ts>(args)...);
+    }
+
+    static void clone(FunctionBuffer &to, const FunctionBuffer &from) {
+        create(to, get(from));
+    }
+
+    static void move(FunctionBuffer &to, FunctionBuffer &from) noexcept {
+        pointer(to) = pointer(from);
+    }
+
+    static void destroy(FunctionBuffer &buffer) noexcept {
+        delete pointer(buffer);
+    }
+};
+
+// A target too large to store inline, kept in memory from an allocator.
+template <typename F, typename Alloc>
+struct AllocatedStorage {
+    struct Block {
+        Alloc alloc;
+        F f;
+
+        template <typename... Ts>
+        explicit Block(const Alloc &a, Ts &&...args) : alloc(a), f(std::forward<Ts>(args)...) {}
+    };
+
+    using Target = F;
+    using BlockAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Block>;
+    using Traits = std::allocator_traits<BlockAlloc>;
+
+    static Block *&pointer(FunctionBuffer &buffer) noexcept {
+        return *reinterpret_cast<Block **>(&buffer);
+    }
+
+    static const Block *pointer(const FunctionBuffer &buffer) noexcept {
+        return *reinterpret_cast<Block *const *>(&buffer);
+    }
+
+    static F &get(FunctionBuffer &buffer) noexcept {
+        return pointer(buffer)->f;
+    }
+
+    static const F &get(const FunctionBuffer &buffer) noexcept {
+        return pointer(buffer)->f;
+    }
+
+    template <typename... Ts>
+    static void create(FunctionBuffer &buffer, const Alloc &alloc, Ts &&...args) {
+        BlockAlloc block_alloc(alloc);
+        auto block = Traits::allocate(block_alloc, 1);
+        try {
+            new (block) Block(alloc, std::forward<Ts>(args)...);
+        } catch (...) {
+            Traits::deallocate(block_alloc, block, 1);
+            throw;
+        }
+        pointer(buffer) = block;
+    }
+
+    // Copies come from the same allocator.
+    static void clone(FunctionBuffer &to, const FunctionBuffer &from) {
+        create(to, pointer(from)->alloc, pointer(from)->f);
+    }
+
+    static void move(FunctionBuffer &to, FunctionBuffer &from) noexcept {
+        pointer(to) = pointer(from);
+    }
+
+    static void destroy(FunctionBuffer &buffer) noexcept {
+        auto block = pointer(buffer);
+        BlockAlloc block_alloc(block->alloc);
+        block->~Block();
+        Traits::deallocate(block_alloc, block, 1);
+    }
+};
+
+template <typename F>
+class SharedTarget;
+
+// A shared target reports the type it wraps, not the wrapper.
+template <typename F>
+struct TargetOf {
+    using type = F;
+
+    static void *get(F &f) noexcept {
+        return std::addressof(f);
+    }
+
+    static const void *get(const F &f) noexcept {
+        return std::addressof(f);
+    }
+};
+
+// Writes through a shared target must not reach the other copies.
+template <typename F>
+struct TargetOf<SharedTarget<F>> {
+    using type = F;
+
+    static void *get(SharedTarget<F> &f) {
+        return f.unshare();
+    }
+
+    static const void *get(const SharedTarget<F> &f) noexcept {
+        return f.get();
+    }
 };
 
+template <typename S>
+void *target(FunctionBuffer &buffer) {
+    return TargetOf<typename S::Target>::get(S::get(buffer));
+}
+
+template <typename S>
+const void *const_target(const FunctionBuffer &buffer) noexcept {
+    return TargetOf<typename S::Target>::get(S::get(buffer));
+}
+
+// Everything but invocation, which goes through a pointer in the Function itself.
+struct FunctionTable {
+    void (*clone)(FunctionBuffer &, const FunctionBuffer &);
+    void (*move)(FunctionBuffer &, FunctionBuffer &) noexcept;
+    void (*destroy)(FunctionBuffer &) noexcept;
+    TypeId type;
+    void *(*target)(FunctionBuffer &);
+    const void *(*const_target)(const FunctionBuffer &) noexcept;
+};
+
+// S is the storage for a target.
+template <typename S, bool Copyable>
+struct TableOf {
+    static constexpr FunctionTable value {
+        &S::clone, &S::move, &S::destroy,
+        type_id<typename TargetOf<typename S::Target>::type>(), &target<S>, &const_target<S>};
+};
+
+template <typename S, bool Copyable>
+constexpr FunctionTable TableOf<S, Copyable>::value;
+
+template <typename S>
+struct TableOf<S, false> {
+    static constexpr FunctionTable value {
+        nullptr, &S::move, &S::destroy,
+        type_id<typename TargetOf<typename S::Target>::type>(), &target<S>, &const_target<S>};
+};
+
+template <typename S>
+constexpr FunctionTable TableOf<S, false>::value;
+
+// Calls f, which may also be a pointer to a member of the first argument,
+// given either as an object or as a pointer to one.
+template <typename F, typename... Ts>
+auto call(F &&f, Ts &&...args) -> decltype(std::forward<F>(f)(std::forward<Ts>(args)...)) {
+    return std::forward<F>(f)(std::forward<Ts>(args)...);
+}
+
+template <typename M, typename C, typename T, typename... Ts>
+auto call(M C::*f, T &&object, Ts &&...args)
+    -> decltype((std::forward<T>(object).*f)(std::forward<Ts>(args)...)) {
+    return (std::forward<T>(object).*f)(std::forward<Ts>(args)...);
+}
+
+template <typename M, typename C, typename T, typename... Ts>
+auto call(M C::*f, T &&object, Ts &&...args)
+    -> decltype(((*std::forward<T>(object)).*f)(std::forward<Ts>(args)...)) {
+    return ((*std::forward<T>(object)).*f)(std::forward<Ts>(args)...);
+}
+
+template <typename M, typename C, typename T>
+auto call(M C::*f, T &&object) -> decltype(std::forward<T>(object).*f) {
+    return std::forward<T>(object).*f;
+}
+
+template <typename M, typename C, typename T>
+auto call(M C::*f, T &&object) -> decltype((*std::forward<T>(object)).*f) {
+    return (*std::forward<T>(object)).*f;
+}
+
+template <typename S, typename R, typename... Args>
+R invoke(FunctionBuffer &buffer, Args &&...args) {
+    return static_cast<R>(internal::call(S::get(buffer), std::forward<Args>(args)...));
+}
+
+template <typename F>
+constexpr bool is_null(const F &) noexcept {
+    return false;
+}
+
+template <typename F>
+constexpr bool is_null(F *f) noexcept {
+    return !f;
+}
+
+template <typename M, typename C>
+constexpr bool is_null(M C::*f) noexcept {
+    return !f;
+}
+
+template <typename F, typename = void, typename... Args>
+struct IsConstCallable : std::false_type {};
+
 template <typename F, typename... Args>
-class Function final : public FunctionBase<std::result_of_t<F(Args...)>, Args...> {
-    using _R = std::result_of_t<F(Args...)>;
-    F _f;
+struct IsConstCallable<F,
+                       decltype(void(internal::call(std::declval<const F &>(),
+                                                    std::declval<Args>()...))),
+                       Args...> : std::true_type {};
+
+// Copies share the target until a copy calls it through a non-const call
+// operator; that copy then gets a target of its own.
+template <typename F>
+class SharedTarget {
+    SharedPtr<F> _f;
+
+    template <typename... Ts>
+    decltype(auto) _call(std::true_type, Ts &&...args) {
+        return internal::call(static_cast<const F &>(*_f), std::forward<Ts>(args)...);
+    }
+
+    template <typename... Ts>
+    decltype(auto) _call(std::false_type, Ts &&...args) {
+        return internal::call(*unshare(), std::forward<Ts>(args)...);
+    }
 
 public:
     template <typename G>
-    Function(G &&f) noexcept(std::is_nothrow_constructible<F, G>::value) :
-        _f{std::forward<G>(f)} {}
+    explicit SharedTarget(G &&f) : _f{MakeShared<F>(std::forward<G>(f))} {}
 
-    _R operator()(Args... args) override {
-        return _f(args...);
+    const F *get() const noexcept {
+        return _f.get();
     }
 
-    std::unique_ptr<FunctionBase<_R, Args...>> clone() const override {
-        return std::make_unique<Function>(_f);
+    // Gives this copy a target of its own if others share it.
+    F *unshare() {
+        if (!_f.unique()) _f = MakeShared<F>(static_cast<const F &>(*_f));
+        return _f.get();
+    }
+
+    template <typename... Ts>
+    decltype(auto) operator()(Ts &&...args) {
+        return _call(IsConstCallable<F, void, Ts...> {}, std::forward<Ts>(args)...);
     }
 };
 
-template <typename... Args, typename F>
-auto function(F &&f) {
-    return std::make_unique<Function<F, Args...>>(
-        std::forward<F>(f)
-    );
-}
+// Small targets that can be moved without throwing are stored inline.
+template <bool Copyable, typename R, typename... Args>
+class FunctionHolder {
+protected:
+    FunctionBuffer _buffer;
+    R (*_invoke)(FunctionBuffer &, Args &&...);
+    const FunctionTable *_table;
 
-template <typename... Args, typename F>
-auto function(F *f) {
-    return f
-        ? std::make_unique<Function<F &, Args...>>(*f)
-        : nullptr;
-}
+    constexpr FunctionHolder() noexcept : _buffer{}, _invoke{}, _table{} {}
+
+    template <typename F>
+    explicit FunctionHolder(F &&f) : _invoke{}, _table{} {
+        if (!is_null(f)) _create<Storage<std::decay_t<F>>>(std::forward<F>(f));
+    }
+
+    // Targets that fit inline never touch the allocator.
+    template <typename Alloc, typename F, typename G = std::decay_t<F>>
+    FunctionHolder(std::allocator_arg_t, const Alloc &alloc, F &&f) : _invoke{}, _table{} {
+        if (!is_null(f)) _create_with(FitsInline<G> {}, alloc, std::forward<F>(f));
+    }
+
+    template <typename F>
+    FunctionHolder(ShareTarget, F &&f) : _invoke{}, _table{} {
+        if (!is_null(f)) _create<Storage<SharedTarget<std::decay_t<F>>>>(std::forward<F>(f));
+    }
+
+    FunctionHolder(const FunctionHolder &that) : _invoke{}, _table{} {
+        if (!that._table) return;
+        that._table->clone(_buffer, that._buffer);
+        _invoke = that._invoke;
+        _table = that._table;
+    }
+
+    FunctionHolder(FunctionHolder &&that) noexcept {
+        _take(that);
+    }
+
+    FunctionHolder &operator=(FunctionHolder &&that) noexcept {
+        if (this != &that) {
+            _reset();
+            _take(that);
+        }
+        return *this;
+    }
+
+    ~FunctionHolder() {
+        _reset();
+    }
+
+    template <typename S, typename... Ts>
+    void _create(Ts &&...args) {
+        S::create(_buffer, std::forward<Ts>(args)...);
+        _invoke = &invoke<S, R, Args...>;
+        _table = &TableOf<S, Copyable>::value;
+    }
+
+    template <typename Alloc, typename F>
+    void _create_with(std::true_type, const Alloc &, F &&f) {
+        _create<Storage<std::decay_t<F>>>(std::forward<F>(f));
+    }
+
+    template <typename Alloc, typename F>
+    void _create_with(std::false_type, const Alloc &alloc, F &&f) {
+        _create<AllocatedStorage<std::decay_t<F>, Alloc>>(alloc, std::forward<F>(f));
+    }
+
+    void _reset() noexcept {
+        if (_table) _table->destroy(_buffer);
+        _invoke = nullptr;
+        _table = nullptr;
+    }
+
+    void _take(FunctionHolder &that) noexcept {
+        _invoke = that._invoke;
+        _table = that._table;
+        if (_table) _table->move(_buffer, that._buffer);
+        that._invoke = nullptr;
+        that._table = nullptr;
+    }
+
+public:
+    // From here on arguments are passed by reference, so a by-value parameter
+    // is only moved once more, into the target's parameter.
+    R operator()(Args... args) {
+        return _invoke ? _invoke(_buffer, std::forward<Args>(args)...) : throw BadFunctionCall {};
+    }
+
+    explicit operator bool() const noexcept {
+        return _invoke;
+    }
+
+    // type_id<void>() if empty.
+    TypeId target_type() const noexcept {
+        return _table ? _table->type : type_id<void>();
+    }
+
+    // Null unless the target is a T. A target stored with share_target is
+    // first copied if other Functions share it, as a non-const call would.
+    template <typename T>
+    T *target() {
+        return _table && _table->type == type_id<T>()
+            ? static_cast<T *>(_table->target(_buffer))
+            : nullptr;
+    }
+
+    template <typename T>
+    const T *target() const noexcept {
+        return _table && _table->type == type_id<T>()
+            ? static_cast<const T *>(_table->const_target(_buffer))
+            : nullptr;
+    }
+};
 }
 
 template <typename>
 class Function;
 
 template <typename R, typename... Args>
-class Function<R(Args...)> {
-    std::unique_ptr<internal::FunctionBase<R, Args...>> _f;
+class Function<R(Args...)> : public internal::FunctionHolder<true, R, Args...> {
+    using _Holder = internal::FunctionHolder<true, R, Args...>;
 
 public:
     constexpr Function() noexcept = default;
     constexpr Function(std::nullptr_t) noexcept : Function{} {}
 
+    template <typename F,
+              typename = std::enable_if_t<!std::is_same<std::decay_t<F>, Function>::value>>
+    Function(F &&f) : _Holder{std::forward<F>(f)} {}
+
     template <typename F>
-    Function(F &&f) :
-        _f{internal::function<Args...>(f)} {}
+    Function(ShareTarget tag, F &&f) : _Holder{tag, std::forward<F>(f)} {}
 
-    Function(const Function &that) :
-        _f{that._f ? that._f->clone() : nullptr} {}
+    template <typename Alloc, typename F>
+    Function(std::allocator_arg_t tag, const Alloc &alloc, F &&f) :
+        _Holder{tag, alloc, std::forward<F>(f)} {}
+
+    Function(const Function &) = default;
 
     Function(Function &&) noexcept = default;
 
     Function &operator=(const Function &that) {
-        if (this != &that) {
-            _f = that._f ? that._f->clone() : nullptr;
-        }
+        if (this != &that) *this = Function {that};
         return *this;
     }
 
     Function &operator=(Function &&) noexcept = default;
+};
 
-    R operator()(Args... args) {
-        return _f ? (*_f)(args...) : throw BadFunctionCall {};
+template <typename>
+class UniqueFunction;
+
+// Like Function, but only movable, so it can hold move-only targets.
+template <typename R, typename... Args>
+class UniqueFunction<R(Args...)> : public internal::FunctionHolder<false, R, Args...> {
+    using _Holder = internal::FunctionHolder<false, R, Args...>;
+
+public:
+    constexpr UniqueFunction() noexcept = default;
+    constexpr UniqueFunction(std::nullptr_t) noexcept : UniqueFunction{} {}
+
+    template <typename F,
+              typename = std::enable_if_t<!std::is_same<std::decay_t<F>, UniqueFunction>::value>>
+    UniqueFunction(F &&f) : _Holder{std::forward<F>(f)} {}
+
+    template <typename Alloc, typename F>
+    UniqueFunction(std::allocator_arg_t tag, const Alloc &alloc, F &&f) :
+        _Holder{tag, alloc, std::forward<F>(f)} {}
+
+    UniqueFunction(UniqueFunction &&) noexcept = default;
+    UniqueFunction &operator=(UniqueFunction &&) noexcept = default;
+};
+
+template <typename>
+class FunctionRef;
+
+// Refers to a callable without owning it, so it must not outlive its target.
+template <typename R, typename... Args>
+class FunctionRef<R(Args...)> {
+    union _Callable {
+        void *object;
+        void (*function)();
+    };
+
+    _Callable _callable;
+    R (*_invoke)(_Callable, Args &&...);
+
+    template <typename F>
+    static R _invoke_object(_Callable callable, Args &&...args) {
+        return static_cast<R>((*static_cast<F *>(callable.object))(std::forward<Args>(args)...));
     }
 
-    explicit operator bool() const noexcept {
-        return static_cast<bool>(_f);
+    template <typename F>
+    static R _invoke_function(_Callable callable, Args &&...args) {
+        return static_cast<R>(reinterpret_cast<F *>(callable.function)(std::forward<Args>(args)...));
+    }
+
+    template <typename F>
+    void _bind(F &f, std::false_type) noexcept {
+        _callable.object = const_cast<void *>(static_cast<const volatile void *>(std::addressof(f)));
+        _invoke = &_invoke_object<F>;
+    }
+
+    // Functions and function pointers are kept by value, so a temporary
+    // pointer need not outlive the FunctionRef.
+    template <typename F>
+    void _bind(F *f, std::true_type) noexcept {
+        _callable.function = reinterpret_cast<void (*)()>(f);
+        _invoke = &_invoke_function<F>;
+    }
+
+    template <typename F, typename P = std::decay_t<F>>
+    using _IsFunction = std::integral_constant<bool,
+        std::is_pointer<P>::value && std::is_function<std::remove_pointer_t<P>>::value>;
+
+public:
+    template <typename F,
+              typename = std::enable_if_t<!std::is_same<std::decay_t<F>, FunctionRef>::value>>
+    FunctionRef(F &&f) noexcept {
+        _bind(f, _IsFunction<F> {});
+    }
+
+    R operator()(Args... args) const {
+        return _invoke(_callable, std::forward<Args>(args)...);
     }
 };
 
@@ -122,6 +706,26 @@ template <typename R, typename... Args>
 bool operator!=(std::nullptr_t, const Function<R(Args...)> &f) noexcept {
     return static_cast<bool>(f);
 }
+
+template <typename R, typename... Args>
+bool operator==(const UniqueFunction<R(Args...)> &f, std::nullptr_t) noexcept {
+    return !f;
+}
+
+template <typename R, typename... Args>
+bool operator==(std::nullptr_t, const UniqueFunction<R(Args...)> &f) noexcept {
+    return !f;
+}
+
+template <typename R, typename... Args>
+bool operator!=(const UniqueFunction<R(Args...)> &f, std::nullptr_t) noexcept {
+    return static_cast<bool>(f);
+}
+
+template <typename R, typename... Args>
+bool operator!=(std::nullptr_t, const UniqueFunction<R(Args...)> &f) noexcept {
+    return static_cast<bool>(f);
+}
 }
 
 #endif // CS540_FUNCTION_HPP
@@ -0,0 +1,130 @@
+#ifndef CS540_FUNCTION_QUEUE_HPP
+#define CS540_FUNCTION_QUEUE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "Function.hpp"
+
+namespace cs540 {
+template <typename>
+class FunctionQueue;
+
+// A bounded multi-producer, multi-consumer queue. Each slot holds its
+// Function in place on a cache line of its own, so pushing a small target
+// never allocates. A slot's sequence number says whose turn it is: a
+// producer at position pos waits for pos, and a consumer for pos + 1.
+template <typename R, typename... Args>
+class FunctionQueue<R(Args...)> {
+    using _Function = Function<R(Args...)>;
+
+    static constexpr std::size_t _LINE = 64;
+
+    struct alignas(_LINE) _Slot {
+        std::atomic_size_t sequence;
+        std::aligned_storage_t<sizeof(_Function), alignof(_Function)> storage;
+
+        _Function &get() noexcept {
+            return *reinterpret_cast<_Function *>(&storage);
+        }
+    };
+
+    const std::size_t _mask;
+    void *const _memory;
+    _Slot *const _slots;
+    // Padding rather than alignas, which C++14's operator new can't honour,
+    // keeps each index off the other's line and the fields read by both.
+    char _pad0[_LINE];
+    std::atomic_size_t _head;
+    char _pad1[_LINE - sizeof(std::atomic_size_t)];
+    std::atomic_size_t _tail;
+
+    static std::size_t _round_up(std::size_t capacity) noexcept {
+        std::size_t size = 1;
+        while (size < capacity) size <<= 1;
+        return size;
+    }
+
+    // Plain operator new only guarantees alignment up to max_align_t.
+    static _Slot *_align(void *memory) noexcept {
+        auto address = reinterpret_cast<std::uintptr_t>(memory);
+        return reinterpret_cast<_Slot *>((address + _LINE - 1) & ~(_LINE - 1));
+    }
+
+public:
+    // The capacity is rounded up to a power of two.
+    explicit FunctionQueue(std::size_t capacity) :
+        _mask{_round_up(capacity) - 1},
+        _memory{::operator new((_mask + 1) * sizeof(_Slot) + _LINE - 1)},
+        _slots{_align(_memory)}, _head{0}, _tail{0} {
+        for (std::size_t i = 0; i <= _mask; i++) {
+            new (&_slots[i]) _Slot;
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    FunctionQueue(const FunctionQueue &) = delete;
+    FunctionQueue &operator=(const FunctionQueue &) = delete;
+
+    ~FunctionQueue() {
+        auto head = _head.load(std::memory_order_relaxed);
+        auto tail = _tail.load(std::memory_order_relaxed);
+        for (; head != tail; head++) _slots[head & _mask].get().~_Function();
+        ::operator delete(_memory);
+    }
+
+    std::size_t capacity() const noexcept {
+        return _mask + 1;
+    }
+
+    // Returns false, leaving f alone, if the queue is full.
+    bool try_push(_Function &&f) noexcept {
+        auto pos = _tail.load(std::memory_order_relaxed);
+        _Slot *slot;
+        for (;;) {
+            slot = &_slots[pos & _mask];
+            auto sequence = slot->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(sequence - pos);
+            if (!diff) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+        new (&slot->storage) _Function(std::move(f));
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty.
+    bool try_pop(_Function &f) noexcept {
+        auto pos = _head.load(std::memory_order_relaxed);
+        _Slot *slot;
+        for (;;) {
+            slot = &_slots[pos & _mask];
+            auto sequence = slot->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(sequence - (pos + 1));
+            if (!diff) {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+        f = std::move(slot->get());
+        slot->get().~_Function();
+        slot->sequence.store(pos + _mask + 1, std::memory_order_release);
+        return true;
+    }
+}; // template <typename R, typename... Args> class FunctionQueue<R(Args...)>
+}
+
+#endif // CS540_FUNCTION_QUEUE_HPP
@@ -0,0 +1,173 @@
+#include "FunctionQueue.hpp"
+#include <iostream>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+std::atomic<std::size_t> AllocationCount(0);
+
+void *operator new(std::size_t sz) {
+  ++AllocationCount;
+  void *p = std::malloc(sz);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+struct tracked_functor_t {
+  static std::atomic<int> live;
+  tracked_functor_t() { ++live; }
+  tracked_functor_t(const tracked_functor_t &) noexcept { ++live; }
+  ~tracked_functor_t() { --live; }
+  void operator()() {}
+};
+
+std::atomic<int> tracked_functor_t::live;
+
+//The mutex-guarded deque the queue replaces, kept for comparison
+class locked_queue {
+  std::mutex _lock;
+  std::deque<cs540::Function<void()>> _queue;
+public:
+  bool try_push(cs540::Function<void()> &&f) {
+    std::lock_guard<std::mutex> guard(_lock);
+    _queue.push_back(std::move(f));
+    return true;
+  }
+  bool try_pop(cs540::Function<void()> &f) {
+    std::lock_guard<std::mutex> guard(_lock);
+    if (_queue.empty()) {
+      return false;
+    }
+    f = std::move(_queue.front());
+    _queue.pop_front();
+    return true;
+  }
+};
+
+const int TASKS = 200000;
+
+//Runs TASKS tasks through a queue, returning tasks per second
+template <typename Queue>
+double throughput(Queue &queue, int producers, int consumers) {
+  std::atomic<long> done(0), sum(0);
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&queue, &sum, p, producers]() {
+      for (int i = p; i < TASKS; i += producers) {
+        cs540::Function<void()> task = [&sum, i]() {
+          sum.fetch_add(i, std::memory_order_relaxed);
+        };
+        while (!queue.try_push(std::move(task))) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (int c = 0; c < consumers; c++) {
+    threads.emplace_back([&queue, &done]() {
+      cs540::Function<void()> task;
+      while (done.load(std::memory_order_relaxed) < TASKS) {
+        if (queue.try_pop(task)) {
+          task();
+          done.fetch_add(1, std::memory_order_relaxed);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+  assert(sum == long(TASKS) * (TASKS - 1) / 2);
+  return TASKS / std::chrono::duration<double>(end - start).count();
+}
+
+//The queue itself must be safe to allocate with plain operator new
+static_assert(alignof(cs540::FunctionQueue<void()>) <= alignof(std::max_align_t),
+              "FunctionQueue is over-aligned");
+
+int main(void) {
+  {
+    //Test that the capacity is rounded up to a power of two
+    cs540::FunctionQueue<int()> queue(5);
+    assert(queue.capacity() == 8);
+  }
+
+  {
+    //Test FIFO order, and full and empty queues
+    cs540::FunctionQueue<int()> queue(4);
+    cs540::Function<int()> f;
+    assert(!queue.try_pop(f));
+    for (int i = 0; i < 4; i++) {
+      assert(queue.try_push([i]() { return i; }));
+    }
+    cs540::Function<int()> extra = []() { return 4; };
+    assert(!queue.try_push(std::move(extra)));
+    assert(extra && extra() == 4);
+    for (int i = 0; i < 4; i++) {
+      assert(queue.try_pop(f) && f() == i);
+    }
+    assert(!queue.try_pop(f));
+
+    //Test wrapping around the ring
+    for (int i = 0; i < 10; i++) {
+      assert(queue.try_push([i]() { return i; }));
+      assert(queue.try_pop(f) && f() == i);
+    }
+  }
+
+  {
+    //Test that small targets are pushed and popped without allocating
+    cs540::FunctionQueue<int(int)> queue(16);
+    cs540::Function<int(int)> f;
+    std::size_t count = AllocationCount;
+    int base = 10;
+    for (int i = 0; i < 100; i++) {
+      assert(queue.try_push([base](int x) { return base + x; }));
+      assert(queue.try_pop(f) && f(i) == base + i);
+    }
+    assert(AllocationCount == count);
+  }
+
+  {
+    //Test that targets left in the queue are destroyed with it
+    {
+      cs540::FunctionQueue<void()> queue(8);
+      for (int i = 0; i < 3; i++) {
+        assert(queue.try_push(tracked_functor_t{}));
+      }
+      cs540::Function<void()> f;
+      assert(queue.try_pop(f));
+      f = nullptr;
+      assert(tracked_functor_t::live == 2);
+    }
+    assert(tracked_functor_t::live == 0);
+  }
+
+  {
+    //Benchmark tasks per second with 1 to 4 producers and consumers
+    for (int threads = 1; threads <= 4; threads *= 2) {
+      cs540::FunctionQueue<void()> queue(1024);
+      locked_queue locked;
+      double lock_free = throughput(queue, threads, threads);
+      double mutex = throughput(locked, threads, threads);
+      std::cout << threads << " producers, " << threads << " consumers: FunctionQueue="
+                << lock_free << " tasks/sec, mutex=" << mutex << " tasks/sec" << std::endl;
+    }
+  }
+}
@@ -1,6 +1,30 @@
 #include "Function.hpp"
 #include <iostream>
 #include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+std::size_t AllocationCount;
+std::size_t AllocatedBytes;
+
+void *operator new(std::size_t sz) {
+  ++AllocationCount;
+  AllocatedBytes += sz;
+  void *p = std::malloc(sz);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
 
 int ret_one_hundred_func() {
   return 100;
@@ -12,6 +36,161 @@ struct ret_two_hundred_functor_t {
   }
 };
 
+struct tracked_functor_t {
+  static int live;
+  tracked_functor_t() { ++live; }
+  tracked_functor_t(const tracked_functor_t &) noexcept { ++live; }
+  ~tracked_functor_t() { --live; }
+  int operator()(){
+    return 400;
+  }
+};
+
+int tracked_functor_t::live;
+
+struct throwing_move_functor_t {
+  throwing_move_functor_t() = default;
+  throwing_move_functor_t(const throwing_move_functor_t &) {}
+  int operator()(){
+    return 500;
+  }
+};
+
+struct counted_arg_t {
+  static int copies, moves;
+  counted_arg_t() = default;
+  counted_arg_t(const counted_arg_t &) { ++copies; }
+  counted_arg_t(counted_arg_t &&) noexcept { ++moves; }
+  static void reset() { copies = moves = 0; }
+};
+
+int counted_arg_t::copies, counted_arg_t::moves;
+
+struct member_t {
+  int value;
+  int get() const {
+    return value;
+  }
+};
+
+//The virtual-dispatch design Function used before, kept for comparison
+template <typename>
+class virtual_function;
+
+template <typename R, typename... Args>
+class virtual_function<R(Args...)> {
+  struct base {
+    virtual ~base() = default;
+    virtual R operator()(Args...) = 0;
+  };
+  template <typename F>
+  struct target : base {
+    F f;
+    target(F g) : f(std::move(g)) {}
+    R operator()(Args... args) override {
+      return f(args...);
+    }
+  };
+  std::unique_ptr<base> _f;
+public:
+  template <typename F>
+  virtual_function(F f) : _f(new target<F>(std::move(f))) {}
+  R operator()(Args... args) {
+    return (*_f)(args...);
+  }
+};
+
+int sum() {
+  return 0;
+}
+
+template <typename... Ts>
+int sum(int a, Ts... rest) {
+  return a + sum(rest...);
+}
+
+const int BENCHMARK_CALLS = 2000000;
+
+template <typename F, typename... Ts>
+double ns_per_call(F &f, Ts... args) {
+  //Going through a volatile pointer keeps the compiler from seeing the target
+  F *volatile fp = &f;
+  volatile int sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCHMARK_CALLS; i++) {
+    sink = sink + (*fp)(args...);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count()/BENCHMARK_CALLS;
+}
+
+template <typename... Ts>
+void benchmark(Ts... args) {
+  auto target = [](Ts... xs) {
+    return sum(xs...);
+  };
+  cs540::Function<int(Ts...)> function(target);
+  virtual_function<int(Ts...)> virtual_design(target);
+  //A second target type keeps the compiler from guessing the only override
+  virtual_function<int(Ts...)> other([](Ts...) {
+    return 0;
+  });
+  assert(other(args...) == 0);
+  std::function<int(Ts...)> std_function(target);
+  assert(function(args...) == sum(args...));
+  double t1 = ns_per_call(function, args...);
+  double t2 = ns_per_call(virtual_design, args...);
+  double t3 = ns_per_call(std_function, args...);
+  cs540::FunctionRef<int(Ts...)> function_ref(target);
+  double t4 = ns_per_call(function_ref, args...);
+  std::cout << sizeof...(Ts) << " args: Function=" << t1 << " ns, virtual=" << t2
+            << " ns, std::function=" << t3 << " ns, FunctionRef=" << t4 << " ns" << std::endl;
+}
+
+int count_if(const std::vector<int> &v, cs540::FunctionRef<bool(int)> pred) {
+  int n = 0;
+  for (int x : v) {
+    n += pred(x);
+  }
+  return n;
+}
+
+const int SUBSCRIBERS = 256;
+
+//Fans one large closure out to many copies, reporting bytes allocated and time per copy
+void fan_out(const char *name, const cs540::Function<int(int)> &f) {
+  std::vector<cs540::Function<int(int)>> subscribers;
+  subscribers.reserve(SUBSCRIBERS);
+  std::size_t bytes = AllocatedBytes;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < SUBSCRIBERS; i++) {
+    subscribers.push_back(f);
+  }
+  auto end = std::chrono::steady_clock::now();
+  int total = 0;
+  for (auto &s : subscribers) {
+    total += s(1);
+  }
+  assert(total == SUBSCRIBERS);
+  std::cout << name << ": " << (AllocatedBytes - bytes)/SUBSCRIBERS << " bytes/copy, "
+            << std::chrono::duration<double, std::nano>(end - start).count()/SUBSCRIBERS
+            << " ns/copy" << std::endl;
+}
+
+const int ARENA_FUNCTIONS = 100000;
+
+//Times creating and destroying Functions with captures too large to store inline
+template <typename Make>
+double ns_per_function(Make make) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ARENA_FUNCTIONS; i++) {
+    cs540::Function<int()> f = make(i);
+    assert(f() == i % 100);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count()/ARENA_FUNCTIONS;
+}
+
 int sumrange(int a, int b) {
   assert(a<=b);
   return a<b ? a + sumrange(a+1,b) : b;
@@ -144,6 +323,422 @@ int main(void) {
       
       assert(sum_range(40) == sumrange(30,40));
     }
+
+    {
+      //Test that small targets are stored without allocating
+      std::size_t count = AllocationCount;
+      void *p1 = &count, *p2 = &testval, *p3 = &count;
+      cs540::Function<int()> small = [p1,p2,p3]() {
+        return p1 != p2 && p1 == p3 ? 1 : 0;
+      };
+      cs540::Function<int()> func(ret_one_hundred_func);
+      cs540::Function<int()> lambda(ret_three_hundred_lambda_func);
+      cs540::Function<int()> copy(small);
+      cs540::Function<int()> moved(std::move(copy));
+      copy = lambda;
+      lambda = std::move(func);
+      assert(AllocationCount == count);
+      assert(small() == 1 && moved() == 1);
+      assert(copy() == 300 && lambda() == 100 && !func);
+    }
+
+    {
+      //Test that large targets are stored on the heap
+      std::size_t count = AllocationCount;
+      char big[64] = {1};
+      cs540::Function<int()> large = [big]() {
+        return big[0];
+      };
+      assert(AllocationCount == count + 1);
+      cs540::Function<int()> copy(large);
+      assert(AllocationCount == count + 2);
+      cs540::Function<int()> moved(std::move(copy));
+      assert(AllocationCount == count + 2);
+      assert(large() == 1 && moved() == 1 && !copy);
+
+      //Targets that may throw while moving go on the heap too
+      cs540::Function<int()> throwing(throwing_move_functor_t{});
+      assert(AllocationCount == count + 3);
+      assert(throwing() == 500);
+    }
+
+    {
+      //Test that inline targets are destroyed exactly once
+      {
+        cs540::Function<int()> tmp(tracked_functor_t{});
+        cs540::Function<int()> copy(tmp);
+        cs540::Function<int()> moved(std::move(tmp));
+        assert(tracked_functor_t::live == 2);
+        copy = nullptr;
+        assert(tracked_functor_t::live == 1);
+        assert(moved() == 400);
+      }
+      assert(tracked_functor_t::live == 0);
+    }
+
+    {
+      //Test a null function pointer
+      int (*null_func)() = nullptr;
+      cs540::Function<int()> tmp(null_func);
+      assert(!tmp);
+    }
+
+    {
+      //Test that arguments are forwarded, counting copies and moves per call
+      counted_arg_t arg;
+      cs540::Function<void(counted_arg_t)> by_value = [](counted_arg_t) {};
+      cs540::Function<void(const counted_arg_t &)> by_ref = [](const counted_arg_t &) {};
+      cs540::Function<void(counted_arg_t &&)> by_rvalue = [](counted_arg_t &&) {};
+      cs540::Function<void(counted_arg_t)> hop = [&by_value](counted_arg_t a) {
+        by_value(std::move(a));
+      };
+
+      counted_arg_t::reset();
+      by_value(counted_arg_t{});
+      std::cout << "by value, rvalue: copies=" << counted_arg_t::copies
+                << " moves=" << counted_arg_t::moves << std::endl;
+      assert(counted_arg_t::copies == 0 && counted_arg_t::moves == 1);
+
+      counted_arg_t::reset();
+      by_value(arg);
+      std::cout << "by value, lvalue: copies=" << counted_arg_t::copies
+                << " moves=" << counted_arg_t::moves << std::endl;
+      assert(counted_arg_t::copies == 1 && counted_arg_t::moves == 1);
+
+      counted_arg_t::reset();
+      by_ref(arg);
+      by_rvalue(std::move(arg));
+      std::cout << "by reference: copies=" << counted_arg_t::copies
+                << " moves=" << counted_arg_t::moves << std::endl;
+      assert(counted_arg_t::copies == 0 && counted_arg_t::moves == 0);
+
+      counted_arg_t::reset();
+      hop(counted_arg_t{});
+      std::cout << "through two Functions: copies=" << counted_arg_t::copies
+                << " moves=" << counted_arg_t::moves << std::endl;
+      assert(counted_arg_t::copies == 0 && counted_arg_t::moves == 3);
+
+      //Test an rvalue reference parameter that takes ownership
+      std::vector<int> v(10, 1);
+      std::vector<int> taken;
+      cs540::Function<void(std::vector<int> &&)> take = [&taken](std::vector<int> &&w) {
+        taken = std::move(w);
+      };
+      take(std::move(v));
+      assert(taken.size() == 10 && v.empty());
+
+      //Test arguments that only convert to the parameter type
+      cs540::Function<std::size_t(std::vector<int>)> size = [](std::vector<int> w) { return w.size(); };
+      assert(size({1, 2, 3}) == 3);
+      cs540::Function<bool(int *)> is_null = [](int *p) { return !p; };
+      assert(is_null(0));
+      auto lambda_size = [](std::vector<int> w) { return w.size(); };
+      cs540::FunctionRef<std::size_t(std::vector<int>)> size_ref(lambda_size);
+      assert(size_ref({1, 2}) == 2);
+    }
+
+    {
+      //Test UniqueFunction with a move-only target stored inline
+      std::unique_ptr<int> owned(new int(600));
+      std::size_t count = AllocationCount;
+      cs540::UniqueFunction<int(int)> unique = [p = std::move(owned)](int a) {
+        return *p + a;
+      };
+      assert(unique(1) == 601);
+      cs540::UniqueFunction<int(int)> moved(std::move(unique));
+      assert(!unique && unique == nullptr && moved != nullptr);
+      assert(moved(2) == 602);
+      unique = std::move(moved);
+      assert(unique(3) == 603 && !moved);
+      assert(AllocationCount == count);
+
+      //Test a default constructed UniqueFunction
+      int testval = 30;
+      try {
+        moved(4);
+      } catch(cs540::BadFunctionCall &bfc) {
+        testval += 10;
+      }
+      assert(testval == 40);
+    }
+
+    {
+      //Test UniqueFunction with a large move-only target, and with a Function target
+      char big[64] = {7};
+      std::unique_ptr<int> owned(new int(700));
+      cs540::UniqueFunction<int()> large = [big, p = std::move(owned)]() {
+        return *p + big[0];
+      };
+      cs540::UniqueFunction<int()> moved(std::move(large));
+      assert(moved() == 707 && !large);
+      cs540::UniqueFunction<int()> wrapped(ret_one_hundred);
+      assert(wrapped() == 100);
+      wrapped = nullptr;
+      assert(!wrapped);
+    }
+
+    {
+      //Test FunctionRef with each kind of target, without allocating
+      static_assert(sizeof(cs540::FunctionRef<int()>) == 2*sizeof(void *), "");
+      static_assert(std::is_trivially_copyable<cs540::FunctionRef<int()>>::value, "");
+      std::size_t count = AllocationCount;
+      cs540::FunctionRef<int()> func_ref(ret_one_hundred_func);
+      assert(func_ref() == 100);
+      ret_two_hundred_functor_t functor;
+      cs540::FunctionRef<int()> functor_ref(functor);
+      assert(functor_ref() == 200);
+      cs540::FunctionRef<int()> lambda_ref(ret_three_hundred_lambda_func);
+      assert(lambda_ref() == 300);
+      cs540::FunctionRef<int()> function_ref(ret_one_hundred);
+      assert(function_ref() == 100);
+      cs540::FunctionRef<int()> copy = lambda_ref;
+      assert(copy() == 300);
+
+      //Test that a function pointer is kept by value, not by address
+      cs540::FunctionRef<int()> pointer_ref(&ret_one_hundred_func);
+      int (*pointer)() = ret_one_hundred_func;
+      cs540::FunctionRef<int()> variable_ref(pointer);
+      pointer = nullptr;
+      assert(pointer_ref() == 100 && variable_ref() == 100);
+
+      //Test passing a capturing lambda to a callback parameter
+      assert(AllocationCount == count);
+      std::vector<int> v{1, 5, 10, 15};
+      count = AllocationCount;
+      int limit = 7;
+      assert(count_if(v, [limit](int x) { return x > limit; }) == 2);
+      assert(count_if(v, [&limit](int x) { return x < limit; }) == 2);
+      assert(AllocationCount == count);
+
+      //Test that arguments are still forwarded
+      counted_arg_t::reset();
+      auto by_value = [](counted_arg_t) {};
+      cs540::FunctionRef<void(counted_arg_t)> by_value_ref(by_value);
+      by_value_ref(counted_arg_t{});
+      assert(counted_arg_t::copies == 0 && counted_arg_t::moves == 1);
+    }
+
+    {
+      //Test that shared targets are not copied by copies or const calls
+      std::vector<int> table(1000, 1);
+      cs540::Function<int(int)> shared(cs540::share_target, [table](int i) {
+        return table[i];
+      });
+      std::size_t count = AllocationCount;
+      cs540::Function<int(int)> copy(shared);
+      cs540::Function<int(int)> assigned;
+      assigned = shared;
+      assert(copy(0) == 1 && assigned(999) == 1 && shared(5) == 1);
+      assert(AllocationCount == count);
+
+      //Test that a mutable target is cloned when a copy calls it
+      cs540::Function<int()> counter(cs540::share_target, [n = 0]() mutable {
+        return ++n;
+      });
+      assert(counter() == 1);
+      count = AllocationCount;
+      cs540::Function<int()> counter_copy(counter);
+      assert(AllocationCount == count);
+      assert(counter_copy() == 2);
+      assert(AllocationCount == count + 1);
+      assert(counter() == 2 && counter() == 3 && counter_copy() == 3);
+      assert(AllocationCount == count + 1);
+
+      //Test that null function and member pointers leave a shared Function empty
+      cs540::Function<int()> null_function(cs540::share_target, (int (*)()) nullptr);
+      cs540::Function<int(const member_t &)> null_method(cs540::share_target,
+                                                         (int (member_t::*)() const) nullptr);
+      cs540::Function<int(member_t *)> null_field(cs540::share_target, (int member_t::*) nullptr);
+      assert(!null_function && !null_method && !null_field);
+      int caught = 0;
+      try {
+        null_function();
+      } catch (cs540::BadFunctionCall &) {
+        caught++;
+      }
+      try {
+        null_method(member_t{1});
+      } catch (cs540::BadFunctionCall &) {
+        caught++;
+      }
+      assert(caught == 2);
+
+      //Test member pointers called through an object and through a pointer
+      member_t m{7};
+      cs540::Function<int(const member_t &)> method(&member_t::get);
+      cs540::Function<int(member_t *)> shared_method(cs540::share_target, &member_t::get);
+      cs540::Function<int(member_t *)> field(cs540::share_target, &member_t::value);
+      assert(method(m) == 7 && shared_method(&m) == 7 && field(&m) == 7);
+    }
+
+    {
+      //Test target and target_type with a free-function
+      cs540::Function<int(int, int)> f(sumrange);
+      assert(f.target_type() == cs540::type_id<int (*)(int, int)>());
+      assert(f.target<int (*)(int, int)>() && *f.target<int (*)(int, int)>() == sumrange);
+      assert(!f.target<int (*)()>());
+
+      //Test that the target can be changed in place
+      auto counter_lambda = [n = 0]() mutable {
+        return ++n;
+      };
+      cs540::Function<int()> counter(counter_lambda);
+      assert(counter() == 1);
+      auto target = counter.target<decltype(counter_lambda)>();
+      assert(target && (*target)() == 2 && counter() == 3);
+      const cs540::Function<int()> &const_ref = counter;
+      assert(const_ref.target<decltype(counter_lambda)>() == target);
+
+      //Test an empty Function
+      cs540::Function<int()> empty;
+      assert(empty.target_type() == cs540::type_id<void>());
+      assert(!empty.target<void>() && !empty.target<int (*)()>());
+
+      //Test large, allocated, shared and move-only targets
+      tracked_functor_t tracked;
+      cs540::Function<void()> large(tracked);
+      assert(large.target<tracked_functor_t>());
+      char big[64] = {5};
+      auto big_lambda = [big]() {
+        return int(big[0]);
+      };
+      cs540::MonotonicArena arena;
+      cs540::Function<int()> allocated(std::allocator_arg, cs540::ArenaAllocator<char>(arena),
+                                       big_lambda);
+      assert(allocated.target<decltype(big_lambda)>() &&
+             (*allocated.target<decltype(big_lambda)>())() == 5);
+      cs540::Function<int()> shared(cs540::share_target, big_lambda);
+      cs540::Function<int()> shared_copy(shared);
+      const cs540::Function<int()> &const_shared = shared;
+      const cs540::Function<int()> &const_shared_copy = shared_copy;
+      assert(const_shared.target<decltype(big_lambda)>() == const_shared_copy.target<decltype(big_lambda)>());
+      std::unique_ptr<int> owned(new int(7));
+      cs540::UniqueFunction<int()> unique([p = std::move(owned)]() {
+        return *p;
+      });
+      assert(unique.target_type() != cs540::type_id<void>());
+
+      //Test that writing through a shared target only changes that copy
+      cs540::Function<int()> shared_counter(cs540::share_target, counter_lambda);
+      cs540::Function<int()> counter_copy(shared_counter);
+      auto copy_target = counter_copy.target<decltype(counter_lambda)>();
+      assert(copy_target && (*copy_target)() == 1 && (*copy_target)() == 2);
+      assert(shared_counter() == 1 && counter_copy() == 3);
+      assert(counter_copy.target<decltype(counter_lambda)>() == copy_target);
+    }
+
+    {
+      //Benchmark calling a function pointer target directly, as a dispatcher can
+      cs540::Function<int(int, int)> f(sum<int>);
+      auto direct = *f.target<int (*)(int, int)>();
+      double through_function = ns_per_call(f, 1, 2);
+      double through_pointer = ns_per_call(direct, 1, 2);
+      std::cout << "function pointer target: Function=" << through_function
+                << " ns, direct=" << through_pointer << " ns" << std::endl;
+    }
+
+    {
+      //Benchmark fanning out a closure with a 256 KiB table
+      std::vector<int> table(1 << 16, 1);
+      auto lookup = [table](int i) {
+        return table[i];
+      };
+      fan_out("deep copies", cs540::Function<int(int)>(lookup));
+      fan_out("shared target", cs540::Function<int(int)>(cs540::share_target, lookup));
+    }
+
+    {
+      //Test placing large targets in caller-provided memory
+      alignas(std::max_align_t) static char buffer[4096];
+      cs540::MonotonicArena arena(buffer, sizeof buffer);
+      cs540::ArenaAllocator<char> alloc(arena);
+      std::unique_ptr<int> owned(new int(800));
+      std::size_t count = AllocationCount;
+      {
+        char big[64] = {9};
+        tracked_functor_t tracked;
+        cs540::Function<int()> large(std::allocator_arg, alloc, [big, tracked]() {
+          return big[0];
+        });
+        cs540::Function<int()> copy(large);
+        cs540::Function<int()> moved(std::move(large));
+        assert(copy() == 9 && moved() == 9 && !large);
+        assert(tracked_functor_t::live == 3);
+
+        //Small targets are still stored inline
+        cs540::Function<int()> small(std::allocator_arg, alloc, ret_one_hundred_func);
+        assert(small() == 100);
+
+        //Move-only targets work too
+        cs540::UniqueFunction<int()> unique(std::allocator_arg, alloc,
+                                            [big, p = std::move(owned)]() {
+          return *p + big[0];
+        });
+        assert(unique() == 809);
+      }
+      assert(tracked_functor_t::live == 0);
+      assert(AllocationCount == count);
+
+      //Once the buffer runs out, the arena allocates chunks of its own
+      {
+        std::vector<cs540::Function<int()>> functions;
+        functions.reserve(200);
+        count = AllocationCount;
+        char big[64] = {};
+        for (int i = 0; i < 200; i++) {
+          big[0] = i % 100;
+          functions.emplace_back(std::allocator_arg, alloc, [big]() {
+            return big[0];
+          });
+        }
+        assert(AllocationCount > count && AllocationCount < count + 10);
+        assert(functions[150]() == 50);
+      }
+      arena.reset();
+
+      //Standard allocators work as well
+      char big[64] = {3};
+      cs540::Function<int()> std_alloc(std::allocator_arg, std::allocator<int>(), [big]() {
+        return big[0];
+      });
+      cs540::Function<int()> std_copy(std_alloc);
+      assert(std_alloc() == 3 && std_copy() == 3);
+    }
+
+    {
+      //Benchmark large targets from the global heap and from an arena
+      cs540::MonotonicArena arena(1 << 17);
+      cs540::ArenaAllocator<char> alloc(arena);
+      double heap = ns_per_function([](int i) {
+        char big[64] = {char(i % 100)};
+        return cs540::Function<int()>([big]() {
+          return int(big[0]);
+        });
+      });
+      //Each batch of 1000 plays the part of a request
+      double arena_ns = ns_per_function([&arena, &alloc](int i) {
+        if (i % 1000 == 0) {
+          arena.reset();
+        }
+        char big[64] = {char(i % 100)};
+        return cs540::Function<int()>(std::allocator_arg, alloc, [big]() {
+          return int(big[0]);
+        });
+      });
+      arena.reset();
+      std::cout << "large targets: heap=" << heap << " ns, arena=" << arena_ns << " ns" << std::endl;
+    }
+
+    {
+      //Benchmark calls with 0 to 4 arguments
+      std::cout << "sizeof: Function=" << sizeof(cs540::Function<int()>)
+                << ", std::function=" << sizeof(std::function<int()>) << std::endl;
+      benchmark();
+      benchmark(1);
+      benchmark(1, 2);
+      benchmark(1, 2, 3);
+      benchmark(1, 2, 3, 4);
+    }
   }
 }
 
@@ -1,17 +1,27 @@
 #ifndef CS540_INTERPOLATE_HPP
 #define CS540_INTERPOLATE_HPP
 
+#include <clocale>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
 
+#include <algorithm>
+#include <initializer_list>
 #include <iomanip>
 #include <ios>
+#include <locale>
+#include <memory>
 #include <ostream>
 #include <sstream>
 #include <stdexcept>
+#include <streambuf>
 #include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace cs540 {
 class WrongNumberOfArgs : public std::logic_error {
@@ -38,7 +48,10 @@ constexpr bool is_iomanip(std::ios &(*)(std::ios &)) noexcept {
     return true;
 }
 
-inline bool is_iomanip(std::ostream &(*f)(std::ostream &)) {
+using OstreamManipulator = std::ostream &(*)(std::ostream &);
+
+// Runs the manipulator on a stream that only notes whether it was written to.
+inline bool probe_iomanip(OstreamManipulator f) {
     class NullStreambuf final : public std::streambuf {
         using _Super = std::streambuf;
 
@@ -65,6 +78,21 @@ inline bool is_iomanip(std::ostream &(*f)(std::ostream &)) {
     return !buf.overflowed();
 }
 
+// The standard ostream manipulators are known; any other is probed once per
+// thread and remembered.
+inline bool is_iomanip(OstreamManipulator f) {
+    using Traits = std::ostream::traits_type;
+    if (f == &std::flush<char, Traits>) return true;
+    if (f == &std::endl<char, Traits> || f == &std::ends<char, Traits>) return false;
+    thread_local std::vector<std::pair<OstreamManipulator, bool>> probed;
+    for (auto &entry : probed) {
+        if (entry.first == f) return entry.second;
+    }
+    auto result = probe_iomanip(f);
+    probed.emplace_back(f, result);
+    return result;
+}
+
 constexpr bool is_iomanip(
     const decltype(std::resetiosflags(std::declval<std::ios_base::fmtflags>())) &) noexcept {
     return true;
@@ -91,6 +119,41 @@ constexpr bool is_iomanip(const decltype(std::setw(0)) &) noexcept {
     return true;
 }
 
+// The manipulators is_iomanip() recognizes by type alone.
+template <typename T>
+struct IsIomanip : std::false_type {};
+
+template <>
+struct IsIomanip<std::ios_base &(*)(std::ios_base &)> : std::true_type {};
+
+template <>
+struct IsIomanip<std::ios &(*)(std::ios &)> : std::true_type {};
+
+template <>
+struct IsIomanip<decltype(std::resetiosflags(std::declval<std::ios_base::fmtflags>()))> :
+    std::true_type {};
+
+template <>
+struct IsIomanip<decltype(std::setiosflags(std::declval<std::ios_base::fmtflags>()))> :
+    std::true_type {};
+
+template <>
+struct IsIomanip<decltype(std::setbase(0))> : std::true_type {};
+
+template <>
+struct IsIomanip<decltype(std::setfill('\0'))> : std::true_type {};
+
+template <>
+struct IsIomanip<decltype(std::setprecision(0))> : std::true_type {};
+
+template <>
+struct IsIomanip<decltype(std::setw(0))> : std::true_type {};
+
+// Whether an ostream manipulator prints is only known once it runs.
+template <typename T>
+using IomanipKnown = std::integral_constant<bool,
+    !std::is_same<T, OstreamManipulator>::value>;
+
 template <std::size_t N>
 using size_t_constant = std::integral_constant<std::size_t, N>;
 
@@ -114,7 +177,377 @@ struct CountSpecifiers<size_t_constant<sizeof...(Ts)>, Ts...> {
     CountSpecifiers() = delete;
 };
 
-inline const char *print_till_specifier(const char *fmt, std::ostream &out) {
+// Appends everything written to it to a string. Without a buffer of its own,
+// its writes interleave with appends made directly to the string.
+class StringAppendBuf final : public std::streambuf {
+public:
+    std::string *target = nullptr;
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            target->push_back(traits_type::to_char_type(c));
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        target->append(s, n);
+        return n;
+    }
+};
+
+// Constructing a stream sets up its locale, so each thread keeps one.
+struct BufferStream {
+    StringAppendBuf buf;
+    std::ostream stream{&buf};
+    bool in_use = false;
+
+    BufferStream() {
+        stream.imbue(std::locale::classic());
+    }
+};
+
+template <typename T>
+using is_character = std::integral_constant<bool,
+    std::is_same<T, char>::value || std::is_same<T, signed char>::value ||
+    std::is_same<T, unsigned char>::value>;
+
+template <typename T>
+using is_number = std::integral_constant<bool,
+    std::is_integral<T>::value && !std::is_same<T, bool>::value && !is_character<T>::value &&
+    !std::is_same<T, wchar_t>::value && !std::is_same<T, char16_t>::value &&
+    !std::is_same<T, char32_t>::value>;
+
+// Pointers operator<< prints as addresses.
+template <typename T, typename P = std::remove_pointer_t<T>>
+using is_address = std::integral_constant<bool,
+    std::is_pointer<T>::value && !std::is_volatile<P>::value &&
+    (std::is_object<P>::value || std::is_void<P>::value) &&
+    !is_character<std::remove_cv_t<P>>::value>;
+
+struct PutFallback {};
+struct PutBool {};
+struct PutChar {};
+struct PutNumber {};
+struct PutFloat {};
+struct PutString {};
+struct PutAddress {};
+
+template <typename T>
+using PutKind =
+    std::conditional_t<std::is_same<T, bool>::value, PutBool,
+    std::conditional_t<is_character<T>::value, PutChar,
+    std::conditional_t<is_number<T>::value, PutNumber,
+    std::conditional_t<std::is_floating_point<T>::value, PutFloat,
+    std::conditional_t<std::is_same<T, const char *>::value || std::is_same<T, char *>::value ||
+                       std::is_same<T, std::string>::value, PutString,
+    std::conditional_t<is_address<T>::value, PutAddress, PutFallback>>>>>>;
+
+template <typename T>
+constexpr std::enable_if_t<std::is_signed<T>::value, bool> is_negative(T value) noexcept {
+    return value < 0;
+}
+
+template <typename T>
+constexpr std::enable_if_t<!std::is_signed<T>::value, bool> is_negative(T) noexcept {
+    return false;
+}
+
+// Writes into a string, formatting numbers, characters, strings and pointers
+// itself the way operator<< would with the classic locale. Manipulators and
+// anything else go to a stream that appends to the same string, which also
+// holds the flags, width, precision and fill the fast paths honour.
+class BufferWriter {
+    std::string &_out;
+    std::unique_ptr<BufferStream> _own;
+    BufferStream &_state;
+    std::ostream &_stream;
+
+    // An operator<< that writes with a BufferWriter of its own, while one is
+    // already using this thread's stream, gets another.
+    BufferStream &_acquire() {
+        thread_local BufferStream stream;
+        if (!stream.in_use) return stream;
+        _own.reset(new BufferStream);
+        return *_own;
+    }
+
+    void _fill(std::size_t count) {
+        _out.append(count, _stream.fill());
+    }
+
+    // A prefix, a sign or 0x, is kept before internal padding.
+    void _pad(const char *prefix, std::size_t prefix_size, const char *body, std::size_t body_size) {
+        auto width = _stream.width();
+        _stream.width(0);
+        auto size = prefix_size + body_size;
+        auto padding = width > 0 && std::size_t(width) > size ? std::size_t(width) - size : 0;
+        auto adjust = _stream.flags() & std::ios_base::adjustfield;
+        if (adjust != std::ios_base::left && adjust != std::ios_base::internal) _fill(padding);
+        _out.append(prefix, prefix_size);
+        if (adjust == std::ios_base::internal) _fill(padding);
+        _out.append(body, body_size);
+        if (adjust == std::ios_base::left) _fill(padding);
+    }
+
+    template <typename T>
+    void _put_number(T value, std::ios_base::fmtflags flags) {
+        using U = std::make_unsigned_t<T>;
+        char digits[3 * sizeof(T) + 1];
+        auto end = digits + sizeof digits, begin = end;
+        const char *prefix = "";
+        auto base = flags & std::ios_base::basefield;
+        auto u = static_cast<U>(value);
+        if (base == std::ios_base::hex) {
+            auto table = (flags & std::ios_base::uppercase) ? "0123456789ABCDEF" : "0123456789abcdef";
+            do *--begin = table[u & 0xf]; while (u >>= 4);
+            if ((flags & std::ios_base::showbase) && value) {
+                prefix = (flags & std::ios_base::uppercase) ? "0X" : "0x";
+            }
+        } else if (base == std::ios_base::oct) {
+            do *--begin = char('0' + (u & 07)); while (u >>= 3);
+            if ((flags & std::ios_base::showbase) && value) *--begin = '0';
+        } else {
+            auto negative = is_negative(value);
+            if (negative) u = U(0) - u;
+            do *--begin = char('0' + u % 10); while (u /= 10);
+            if (negative) {
+                prefix = "-";
+            } else if ((flags & std::ios_base::showpos) && std::is_signed<T>::value) {
+                prefix = "+";
+            }
+        }
+        _pad(prefix, std::char_traits<char>::length(prefix), begin, end - begin);
+    }
+
+    // snprintf takes its decimal point from LC_NUMERIC; the classic locale's is '.'.
+    static std::size_t _classic_point(char *text, std::size_t size) noexcept {
+        auto point = std::localeconv()->decimal_point;
+        auto length = std::char_traits<char>::length(point);
+        if (!length || (length == 1 && *point == '.')) return size;
+        auto end = text + size;
+        auto found = std::search(text, end, point, point + length);
+        if (found == end) return size;
+        *found = '.';
+        std::copy(found + length, end, found + 1);
+        return size - (length - 1);
+    }
+
+    // Builds the same printf format that num_put uses.
+    template <typename T>
+    void _put_float(T value, bool long_double) {
+        auto flags = _stream.flags();
+        auto field = flags & std::ios_base::floatfield;
+        auto uppercase = bool(flags & std::ios_base::uppercase);
+        char format[8], *f = format;
+        *f++ = '%';
+        if (flags & std::ios_base::showpos) *f++ = '+';
+        if (flags & std::ios_base::showpoint) *f++ = '#';
+        auto hexfloat = field == (std::ios_base::fixed | std::ios_base::scientific);
+        if (!hexfloat) {
+            *f++ = '.';
+            *f++ = '*';
+        }
+        if (long_double) *f++ = 'L';
+        if (field == std::ios_base::fixed) {
+            *f++ = 'f';
+        } else if (field == std::ios_base::scientific) {
+            *f++ = uppercase ? 'E' : 'e';
+        } else if (hexfloat) {
+            *f++ = uppercase ? 'A' : 'a';
+        } else {
+            *f++ = uppercase ? 'G' : 'g';
+        }
+        *f = '\0';
+        auto precision = _stream.precision() < 0 ? 6 : int(_stream.precision());
+        auto print = [&](char *text, std::size_t size) {
+            return hexfloat ? std::snprintf(text, size, format, value)
+                            : std::snprintf(text, size, format, precision, value);
+        };
+        char small[64];
+        std::unique_ptr<char[]> large;
+        auto text = small;
+        auto size = std::size_t(print(small, sizeof small));
+        if (size >= sizeof small) {
+            large.reset(new char[size + 1]);
+            text = large.get();
+            print(text, size + 1);
+        }
+        size = _classic_point(text, size);
+        std::size_t prefix_size = 0;
+        if (text[0] == '+' || text[0] == '-') {
+            prefix_size = 1;
+        } else if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+            prefix_size = 2;
+        }
+        _pad(text, prefix_size, text + prefix_size, size - prefix_size);
+    }
+
+    // Only manipulators ostream prints nothing for are applied while sizing.
+    template <typename T>
+    std::size_t _bound(const T &manipulator, std::true_type) {
+        _stream << manipulator;
+        return 0;
+    }
+
+    template <typename T>
+    std::size_t _bound(const T &element, std::false_type) {
+        auto width = std::size_t(std::max<std::streamsize>(_stream.width(), 0));
+        _stream.width(0);
+        return std::max(width, _size(element, PutKind<std::decay_t<T>> {}));
+    }
+
+    // std::endl and std::ends write one character; other types are a guess.
+    template <typename T>
+    std::size_t _size(const T &, PutFallback) {
+        return std::is_same<std::decay_t<T>, OstreamManipulator>::value;
+    }
+
+    std::size_t _size(bool, PutBool) {
+        return 5;
+    }
+
+    std::size_t _size(char, PutChar) {
+        return 1;
+    }
+
+    // Digits in octal, and a sign or base.
+    template <typename T>
+    std::size_t _size(T, PutNumber) {
+        return 3 * sizeof(T) + 3;
+    }
+
+    // Fixed notation also needs the integer digits.
+    template <typename T>
+    std::size_t _size(T value, PutFloat) {
+        auto precision = _stream.precision() < 0 ? 6 : std::size_t(_stream.precision());
+        auto size = precision + 32;
+        auto fixed = (_stream.flags() & std::ios_base::floatfield) == std::ios_base::fixed;
+        if (fixed && std::isfinite(value)) {
+            int exponent;
+            std::frexp(value, &exponent);
+            if (exponent > 0) size += std::size_t(exponent) * 30103 / 100000 + 1;
+        }
+        return size;
+    }
+
+    std::size_t _size(const char *s, PutString) {
+        return s ? std::char_traits<char>::length(s) : 0;
+    }
+
+    std::size_t _size(const std::string &s, PutString) {
+        return s.size();
+    }
+
+    std::size_t _size(const void *, PutAddress) {
+        return 2 * sizeof(void *) + 2;
+    }
+
+    template <typename T>
+    void _put(T &&element, PutFallback) {
+        _stream << std::forward<T>(element);
+    }
+
+    void _put(bool value, PutBool) {
+        if (!(_stream.flags() & std::ios_base::boolalpha)) {
+            _put_number(long{value}, _stream.flags());
+        } else if (value) {
+            _pad("", 0, "true", 4);
+        } else {
+            _pad("", 0, "false", 5);
+        }
+    }
+
+    void _put(char c, PutChar) {
+        _pad("", 0, &c, 1);
+    }
+
+    template <typename T>
+    void _put(T value, PutNumber) {
+        _put_number(value, _stream.flags());
+    }
+
+    void _put(double value, PutFloat) {
+        _put_float(value, false);
+    }
+
+    void _put(long double value, PutFloat) {
+        _put_float(value, true);
+    }
+
+    // A null string fails the stream as operator<< would.
+    void _put(const char *s, PutString) {
+        if (!s) {
+            _stream << s;
+        } else {
+            _pad("", 0, s, std::char_traits<char>::length(s));
+        }
+    }
+
+    void _put(const std::string &s, PutString) {
+        _pad("", 0, s.data(), s.size());
+    }
+
+    void _put(const void *p, PutAddress) {
+        auto flags = _stream.flags() & ~(std::ios_base::basefield | std::ios_base::uppercase);
+        _put_number(reinterpret_cast<std::uintptr_t>(p),
+                    flags | std::ios_base::hex | std::ios_base::showbase);
+    }
+
+    void _reset() {
+        _stream.clear();
+        _stream.flags(std::ios_base::dec | std::ios_base::skipws);
+        _stream.width(0);
+        _stream.precision(6);
+        _stream.fill(' ');
+    }
+
+public:
+    // Starts from a new stream's format state.
+    explicit BufferWriter(std::string &out) : _out(out), _state(_acquire()), _stream(_state.stream) {
+        _state.in_use = true;
+        _state.buf.target = &out;
+        _reset();
+    }
+
+    BufferWriter(const BufferWriter &) = delete;
+    BufferWriter &operator=(const BufferWriter &) = delete;
+
+    ~BufferWriter() {
+        _state.in_use = false;
+    }
+
+    // Like a failed ostream, nothing more is written once the stream fails.
+    void write(const char *s, std::streamsize n) {
+        if (_stream.good()) _out.append(s, n);
+    }
+
+    void put(char c) {
+        if (_stream.good()) _out.push_back(c);
+    }
+
+    // An upper bound on what the elements print, given the manipulators among
+    // them, except for types only operator<< can format. Leaves the format
+    // state as it found it fresh.
+    template <typename... Ts>
+    std::size_t bound(const Ts &...elements) {
+        std::size_t size = 0;
+        (void) std::initializer_list<int> {
+            (size += _bound(elements, IsIomanip<std::decay_t<Ts>> {}), 0)...};
+        _reset();
+        return size;
+    }
+
+    template <typename T>
+    BufferWriter &operator<<(T &&element) {
+        if (_stream.good()) _put(std::forward<T>(element), PutKind<std::decay_t<T>> {});
+        return *this;
+    }
+}; // class BufferWriter
+
+template <typename Out>
+const char *print_till_specifier(const char *fmt, Out &out) {
     const char *next = fmt;
     while (true) {
         switch (*next) {
@@ -151,13 +584,13 @@ class Interpolation {
     template <std::size_t I,
               typename T = std::tuple_element_t<I, std::tuple<Ts..., void>>>
     struct _PrintElement {
-        static void run(Interpolation &&interpolation,
-                        std::ostream &out) {
+        template <typename Out>
+        static void run(Interpolation &&interpolation, Out &out) {
             auto &&element = std::get<I>(interpolation._elements);
             bool should_consume = !is_iomanip(element);
             out << std::forward<T>(element);
             if (should_consume) {
-                std::move(interpolation)._print<I + 1>(out);
+                std::move(interpolation).template _print<I + 1>(out);
             } else {
                 _PrintElement<I + 1>::run(std::move(interpolation), out);
             }
@@ -167,7 +600,8 @@ class Interpolation {
 
     template <std::size_t I>
     struct _PrintElement<I, void> {
-        static constexpr void run(Interpolation &&, std::ostream &) noexcept {
+        template <typename Out>
+        static constexpr void run(Interpolation &&, Out &) noexcept {
         }
         _PrintElement() = delete;
     };
@@ -177,8 +611,8 @@ class Interpolation {
 
     void _check_format() const;
 
-    template <std::size_t I>
-    void _print(std::ostream &out) && {
+    template <std::size_t I, typename Out>
+    void _print(Out &out) && {
         _fmt = print_till_specifier(_fmt, out);
         _PrintElement<I>::run(std::move(*this), out);
     }
@@ -194,7 +628,12 @@ public:
         noexcept(std::is_nothrow_move_constructible<std::tuple<Ts &&...>>::value) = default;
 
     friend std::ostream &operator<<(std::ostream &out, Interpolation &&interpolation) {
-        std::move(interpolation)._print<0>(out);
+        std::move(interpolation).template _print<0>(out);
+        return out;
+    }
+
+    friend BufferWriter &operator<<(BufferWriter &out, Interpolation &&interpolation) {
+        std::move(interpolation).template _print<0>(out);
         return out;
     }
 }; // template <typename...> class Interpolation
@@ -221,6 +660,7 @@ void Interpolation<Ts...>::_check_format() const {
                 break;
             case '%':
                 ++expected;
+                // fall through
             default:
                 ++iter;
                 break;
@@ -232,6 +672,163 @@ done:
         throw WrongNumberOfArgs {expected, actual};
     }
 }
+
+// Feeds the literal text of a format, with its escapes resolved, to
+// table.put(), calling table.end_literal() at each specifier and at the end.
+template <typename Table>
+constexpr void parse_format(const char *fmt, Table &table) {
+    for (std::size_t i = 0; fmt[i];) {
+        if (fmt[i] == '\\' && fmt[i + 1] == '%') {
+            table.put('%');
+            i += 2;
+        } else if (fmt[i] == '%') {
+            table.end_literal();
+            ++i;
+        } else {
+            table.put(fmt[i++]);
+        }
+    }
+    table.end_literal();
+}
+
+struct FormatSize {
+    std::size_t length;
+    std::size_t literals;
+
+    constexpr void put(char) noexcept {
+        ++length;
+    }
+
+    constexpr void end_literal() noexcept {
+        ++literals;
+    }
+};
+
+constexpr FormatSize format_size(const char *fmt) noexcept {
+    FormatSize size {};
+    parse_format(fmt, size);
+    return size;
+}
+
+// Literal k, the text after the k-th specifier, ends at text + ends[k].
+template <std::size_t Length, std::size_t Literals>
+struct FormatTable {
+    char text[Length + 1];
+    std::size_t ends[Literals];
+    std::size_t length;
+    std::size_t literals;
+
+    constexpr void put(char c) noexcept {
+        text[length++] = c;
+    }
+
+    constexpr void end_literal() noexcept {
+        ends[literals++] = length;
+    }
+};
+
+template <std::size_t Length, std::size_t Literals>
+constexpr FormatTable<Length, Literals> format_table(const char *fmt) noexcept {
+    FormatTable<Length, Literals> table {};
+    parse_format(fmt, table);
+    return table;
+}
+
+// S::value() returns the format; see CS540_FORMAT.
+template <typename S>
+struct StaticFormat {
+    static constexpr FormatSize size = format_size(S::value());
+    static constexpr FormatTable<size.length, size.literals> table =
+        format_table<size.length, size.literals>(S::value());
+
+    static constexpr std::size_t specifiers() noexcept {
+        return size.literals - 1;
+    }
+
+    template <typename Out>
+    static void write(Out &out, std::size_t literal) {
+        auto begin = literal ? table.ends[literal - 1] : 0;
+        out.write(table.text + begin, table.ends[literal] - begin);
+    }
+};
+
+template <typename S>
+constexpr FormatSize StaticFormat<S>::size;
+
+template <typename S>
+constexpr FormatTable<StaticFormat<S>::size.length, StaticFormat<S>::size.literals>
+    StaticFormat<S>::table;
+
+template <typename S>
+constexpr StaticFormat<S> make_static_format(S) noexcept {
+    return {};
+}
+
+template <bool...>
+struct BoolPack;
+
+template <bool... Bs>
+using all_of = std::is_same<BoolPack<true, Bs...>, BoolPack<Bs..., true>>;
+
+template <typename... Ts>
+constexpr std::size_t count_consumers() noexcept {
+    std::size_t count = 0;
+    // The trailing true keeps the list from being empty without counting.
+    for (bool is_manipulator : {IsIomanip<std::decay_t<Ts>>::value..., true}) {
+        count += !is_manipulator;
+    }
+    return count;
+}
+
+template <typename... Ts>
+std::size_t count_consumers(const Ts &...elements) {
+    std::size_t count = 0;
+    for (bool is_manipulator : {is_iomanip(elements)..., true}) count += !is_manipulator;
+    return count;
+}
+
+// Like Interpolation, but with a format already split into literals, so
+// printing is a write of each literal between the elements. Format is a
+// StaticFormat or a reference to a CompiledFormat.
+template <typename Format, typename... Ts>
+class SegmentedInterpolation {
+    Format _format;
+    std::tuple<Ts &&...> _elements;
+
+    template <typename Out, typename T>
+    void _print_element(Out &out, T &&element, std::size_t &literal) const {
+        bool should_consume = !is_iomanip(element);
+        out << std::forward<T>(element);
+        if (should_consume) _format.write(out, ++literal);
+    }
+
+    template <typename Out, std::size_t... Is>
+    void _print(Out &out, std::index_sequence<Is...>) && {
+        std::size_t literal = 0;
+        _format.write(out, literal);
+        (void) std::initializer_list<int> {
+            (_print_element(out, std::forward<Ts>(std::get<Is>(_elements)), literal), 0)...};
+    }
+
+public:
+    // The caller checks the number of elements.
+    explicit SegmentedInterpolation(Format format, Ts &&...elements) :
+        _format(format), _elements{std::forward<Ts>(elements)...} {}
+
+    SegmentedInterpolation(const SegmentedInterpolation &) = delete;
+    SegmentedInterpolation(SegmentedInterpolation &&)
+        noexcept(std::is_nothrow_move_constructible<std::tuple<Ts &&...>>::value) = default;
+
+    friend std::ostream &operator<<(std::ostream &out, SegmentedInterpolation &&interpolation) {
+        std::move(interpolation)._print(out, std::index_sequence_for<Ts...> {});
+        return out;
+    }
+
+    friend BufferWriter &operator<<(BufferWriter &out, SegmentedInterpolation &&interpolation) {
+        std::move(interpolation)._print(out, std::index_sequence_for<Ts...> {});
+        return out;
+    }
+}; // template <typename, typename...> class SegmentedInterpolation
 } // namespace internal
 
 template <typename... Ts>
@@ -239,6 +836,116 @@ auto Interpolate(const char *fmt, Ts &&...elements) {
     return internal::Interpolation<Ts...> {fmt, std::forward<Ts>(elements)...};
 }
 
+// A format parsed once at run time, for formats that are reused but are not
+// literals.
+class CompiledFormat {
+    template <typename, typename...>
+    friend class internal::SegmentedInterpolation;
+
+    struct _Builder {
+        CompiledFormat &format;
+
+        void put(char c) {
+            format._text.push_back(c);
+        }
+
+        void end_literal() {
+            format._ends.push_back(format._text.size());
+        }
+    };
+
+    std::string _text;
+    std::vector<std::size_t> _ends;
+
+    template <typename Out>
+    void write(Out &out, std::size_t literal) const {
+        auto begin = literal ? _ends[literal - 1] : 0;
+        out.write(_text.data() + begin, _ends[literal] - begin);
+    }
+
+public:
+    explicit CompiledFormat(const char *fmt) {
+        _Builder builder {*this};
+        internal::parse_format(fmt, builder);
+    }
+
+    explicit CompiledFormat(const std::string &fmt) : CompiledFormat{fmt.c_str()} {}
+
+    std::size_t specifiers() const noexcept {
+        return _ends.size() - 1;
+    }
+
+    // Of the literal text, with escapes resolved.
+    std::size_t length() const noexcept {
+        return _text.size();
+    }
+}; // class CompiledFormat
+
+// Elements whose type says whether they are manipulators are counted at
+// compile time; a mismatch fails to compile.
+template <typename S, typename... Ts>
+auto Interpolate(internal::StaticFormat<S> fmt, Ts &&...elements) {
+    constexpr auto expected = internal::StaticFormat<S>::specifiers();
+    constexpr bool known = internal::all_of<internal::IomanipKnown<std::decay_t<Ts>>::value...>::value;
+    static_assert(!known || internal::count_consumers<Ts...>() == expected,
+                  "wrong number of arguments for format");
+    // Only ostream manipulators leave the count to be checked now.
+    if (!known) {
+        auto actual = internal::count_consumers(elements...);
+        if (actual != expected) throw WrongNumberOfArgs {expected, actual};
+    }
+    return internal::SegmentedInterpolation<internal::StaticFormat<S>, Ts...> {
+        fmt, std::forward<Ts>(elements)...};
+}
+
+// The format must outlive the result.
+template <typename... Ts>
+auto Interpolate(const CompiledFormat &fmt, Ts &&...elements) {
+    auto actual = internal::count_consumers(elements...);
+    if (actual != fmt.specifiers()) throw WrongNumberOfArgs {fmt.specifiers(), actual};
+    return internal::SegmentedInterpolation<const CompiledFormat &, Ts...> {
+        fmt, std::forward<Ts>(elements)...};
+}
+
+// Appends to buffer what operator<< would print for Interpolate(fmt, elements...)
+// on a new stream with the classic locale. fmt is anything Interpolate takes.
+// Numbers, characters, strings and pointers are formatted without a stream.
+template <typename Fmt, typename... Ts>
+std::string &InterpolateTo(std::string &buffer, const Fmt &fmt, Ts &&...elements) {
+    internal::BufferWriter writer {buffer};
+    writer << Interpolate(fmt, std::forward<Ts>(elements)...);
+    return buffer;
+}
+
+namespace internal {
+// Escapes only make the literal text shorter.
+inline std::size_t literal_length(const char *fmt) noexcept {
+    return std::char_traits<char>::length(fmt);
+}
+
+template <typename S>
+constexpr std::size_t literal_length(StaticFormat<S>) noexcept {
+    return StaticFormat<S>::size.length;
+}
+
+inline std::size_t literal_length(const CompiledFormat &fmt) noexcept {
+    return fmt.length();
+}
+}
+
+// Like InterpolateTo() into a new string, which is first reserved with room
+// for the literal text and a bound on each element, so it is allocated once
+// unless types only operator<< can format need more.
+template <typename Fmt, typename... Ts>
+std::string InterpolateToString(const Fmt &fmt, Ts &&...elements) {
+    auto interpolation = Interpolate(fmt, std::forward<Ts>(elements)...);
+    std::string result;
+    internal::BufferWriter writer {result};
+    result.reserve(internal::literal_length(fmt) + writer.bound(elements...));
+    writer << std::move(interpolation);
+    return result;
+}
+
 constexpr auto ffr(std::ios &(*f)(std::ios &)) noexcept {
     return f;
 }
@@ -248,4 +955,15 @@ constexpr auto ffr(std::ostream &(*f)(std::ostream &)) noexcept {
 }
 } // namespace cs540
 
+// A format literal parsed at compile time: Interpolate(CS540_FORMAT("i=%"), i).
+#define CS540_FORMAT(fmt)                                                           \
+    ::cs540::internal::make_static_format([] {                                      \
+        struct _Literal {                                                           \
+            static constexpr const char *value() noexcept {                         \
+                return fmt;                                                         \
+            }                                                                       \
+        };                                                                          \
+        return _Literal {};                                                         \
+    }())
+
 #endif // CS540_INTERPOLATE_HPP
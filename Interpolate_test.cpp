@@ -6,8 +6,10 @@
 #include <fstream>
 #include <iomanip>
 #include <cassert>
+#include <clocale>
 #include <ctime>
 #include <cstring>
+#include <chrono>
 // Needed by {set,get}rlimit().
 #include <sys/resource.h>
 #include <sys/time.h>
@@ -15,6 +17,13 @@
 
 constexpr unsigned MEMORY_LIMIT = 1024*1024*30;
 
+constexpr int BENCHMARK_CALLS = 100000;
+
+// A manipulator of our own, which is neither std::endl, std::ends nor std::flush.
+std::ostream &tab(std::ostream &os) {
+    return os.put('\t');
+}
+
 class A {
     friend int main(int argc, char **argv);
     friend std::ostream & operator<<(std::ostream &os, const A &a) {
@@ -52,18 +61,59 @@ operator<<(std::ostream &os, const Out &o) {
     return os;
 }
 
+void compare(const char *func, int line_no, const std::string &cmp, const std::string &actual) {
+    if (actual != cmp) {
+        std::cerr << "Comparison failed at " << func << ":" << line_no << ":\n";
+        std::cerr << "    Correct result: \"" << cmp << "\"\n";
+        std::cerr << "    Actual result: \"" << actual << "\"\n";
+    }
+}
+
+// Checks printing to a stream, InterpolateTo() and InterpolateToString().
 template <typename... Ts>
 void test(const char *func, int line_no, const std::string &cmp, const std::string &fmt, Ts &&...params) {
     std::stringstream s;
     s << cs540::Interpolate(fmt.c_str(), std::forward<Ts>(params)...);
-    if (s.str() != cmp) {
-        std::cerr << "Comparison failed at " << func << ":" << line_no << ":\n";
-        std::cerr << "    Correct result: \"" << cmp << "\"\n";
-        std::cerr << "    Actual result: \"" << s.str() << "\"\n";
-    }
+    compare(func, line_no, cmp, s.str());
+    std::string buffer;
+    compare(func, line_no, cmp, cs540::InterpolateTo(buffer, fmt.c_str(), std::forward<Ts>(params)...));
+    compare(func, line_no, cmp, cs540::InterpolateToString(fmt.c_str(), std::forward<Ts>(params)...));
+}
+
+// The same, with a format from CS540_FORMAT or a CompiledFormat.
+template <typename Fmt, typename... Ts>
+std::enable_if_t<!std::is_convertible<Fmt, std::string>::value>
+test(const char *func, int line_no, const std::string &cmp, const Fmt &fmt, Ts &&...params) {
+    std::stringstream s;
+    s << cs540::Interpolate(fmt, std::forward<Ts>(params)...);
+    compare(func, line_no, cmp, s.str());
+    std::string buffer;
+    compare(func, line_no, cmp, cs540::InterpolateTo(buffer, fmt, std::forward<Ts>(params)...));
+    compare(func, line_no, cmp, cs540::InterpolateToString(fmt, std::forward<Ts>(params)...));
 }
 #define CS540_TEST(...) test(__FUNCTION__, __LINE__, __VA_ARGS__)
 
+// Checks InterpolateTo() and InterpolateToString() against printing to a stream.
+template <typename... Ts>
+void test_same(const char *func, int line_no, const char *fmt, Ts &&...params) {
+    std::stringstream s;
+    s << cs540::Interpolate(fmt, std::forward<Ts>(params)...);
+    std::string buffer;
+    compare(func, line_no, s.str(), cs540::InterpolateTo(buffer, fmt, std::forward<Ts>(params)...));
+    compare(func, line_no, s.str(), cs540::InterpolateToString(fmt, std::forward<Ts>(params)...));
+}
+#define CS540_TEST_SAME(...) test_same(__FUNCTION__, __LINE__, __VA_ARGS__)
+
+// Prints itself with InterpolateTo(), from inside another InterpolateTo().
+struct Nested {
+    int i;
+};
+std::ostream &
+operator<<(std::ostream &os, const Nested &n) {
+    std::string buffer;
+    return os << cs540::InterpolateTo(buffer, "<%>", std::hex, n.i);
+}
+
 int
 main(int argc, char **argv) {
 
@@ -152,7 +202,7 @@ main(int argc, char **argv) {
         std::stringstream s;
         s << Interpolate("i=%, j=%", 1, 2, 3);
         assert(false);
-    } catch (cs540::WrongNumberOfArgs) {
+    } catch (const cs540::WrongNumberOfArgs &) {
         // std::cout << "Caught exception due to too many args." << std::endl;
     }
 
@@ -161,7 +211,7 @@ main(int argc, char **argv) {
         std::stringstream s;
         s << Interpolate("i=%, j=%, k=%", 1, 2);
         assert(false);
-    } catch (cs540::WrongNumberOfArgs) {
+    } catch (const cs540::WrongNumberOfArgs &) {
         // std::cout << "Caught exception due to few args." << std::endl;
     }
 
@@ -270,6 +320,177 @@ main(int argc, char **argv) {
         assert(ss.str() == "11 0xabc 0xaa 123 0567");
     }
 
+    /*
+     * Compile-time formats.
+     */
+
+    CS540_TEST("", CS540_FORMAT(""));
+    CS540_TEST(R"(\)", CS540_FORMAT(R"(\)"));
+    CS540_TEST(R"(%)", CS540_FORMAT(R"(\%)"));
+    CS540_TEST(R"(\%)", CS540_FORMAT(R"(\\%)"));
+    CS540_TEST(" 1234 ", CS540_FORMAT(" % "), 1234);
+    CS540_TEST("i=1, x=3.49887, s=foo, a=768, b=hello, c=x", CS540_FORMAT("i=%, x=%, s=%, a=%, b=%, c=%"), 1, 3.4988678671, "foo", A(768), B("hello"), 'x');
+    CS540_TEST("0x2134, f78", CS540_FORMAT("%, %"), std::showbase, std::hex, 0x2134, std::noshowbase, 0xf78);
+    CS540_TEST("--1.234567899", CS540_FORMAT("%"), std::setw(13), std::setprecision(10), std::setfill('-'), 1.234567899);
+    CS540_TEST("i=1%, x=3.4989, s=foo\n true 1 1234\\",
+     CS540_FORMAT(R"(i=%\%, x=%, s=%% % % %\)"),
+     1, std::setprecision(5), 3.4988678671, "foo", ffr(std::endl), std::boolalpha, true, std::noboolalpha, true, A(1234));
+
+    // With an ostream manipulator, the count can only be checked at run time.
+    try {
+        std::stringstream s;
+        s << Interpolate(CS540_FORMAT("i=%, j=%"), 1, ffr(std::flush), 2, 3);
+        assert(false);
+    } catch (const cs540::WrongNumberOfArgs &) {
+    }
+
+    // Manipulators still apply to the actual ostream.
+    {
+        std::stringstream ss;
+        ss << Interpolate(CS540_FORMAT("% "), 11, std::hex);
+        ss << 0xabc;
+        assert(ss.str() == "11 abc");
+    }
+
+    /*
+     * Compiled formats.
+     */
+
+    CS540_TEST("", CompiledFormat(""));
+    CS540_TEST(R"(\)", CompiledFormat(R"(\)"));
+    CS540_TEST(R"(%)", CompiledFormat(R"(\%)"));
+    CS540_TEST(R"(\%)", CompiledFormat(R"(\\%)"));
+    CS540_TEST(" 1234 ", CompiledFormat(std::string(" % ")), 1234);
+    CS540_TEST("0x2134, f78", CompiledFormat("%, %"), std::showbase, std::hex, 0x2134, std::noshowbase, 0xf78);
+    CS540_TEST("i=1%, x=3.4989, s=foo\n true 1 1234\\",
+     CompiledFormat(R"(i=%\%, x=%, s=%% % % %\)"),
+     1, std::setprecision(5), 3.4988678671, "foo", ffr(std::endl), std::boolalpha, true, std::noboolalpha, true, A(1234));
+
+    // Test reusing one, and a wrong number of args.
+    {
+        CompiledFormat fmt("i=%, j=%");
+        assert(fmt.specifiers() == 2);
+        std::stringstream s;
+        for (int i = 0; i < 3; i++) {
+            s << Interpolate(fmt, i, i * 2) << ";";
+        }
+        assert(s.str() == "i=0, j=0;i=1, j=2;i=2, j=4;");
+        try {
+            s << Interpolate(fmt, 1);
+            assert(false);
+        } catch (const cs540::WrongNumberOfArgs &) {
+        }
+    }
+
+    /*
+     * InterpolateTo() formats without a stream.
+     */
+
+    CS540_TEST_SAME("[%|%|%|%]", std::setw(8), -42, std::left, std::setw(8), -42, std::internal, std::setw(8), -42, std::setw(8), std::showbase, std::hex, 42);
+    CS540_TEST_SAME("%, %, %, %", std::showpos, 7u, 7, true, std::boolalpha, true);
+    CS540_TEST_SAME("%, %, %, %", std::hex, short(-1), std::oct, std::showbase, 0, 8, -1LL);
+    CS540_TEST_SAME("%, %, %", 9223372036854775807LL, -9223372036854775807LL - 1, 18446744073709551615ULL);
+    CS540_TEST_SAME("%, %, %", (void *)nullptr, std::uppercase, (const void *)0xabc, std::setw(12), std::internal, (void *)0xabc);
+    CS540_TEST_SAME("%, %, %", std::fixed, 1e300, std::scientific, std::setprecision(3), 12345.678L, std::hexfloat, 1.5);
+    CS540_TEST_SAME("%, %, %", std::showpoint, 2.0, std::internal, std::setw(9), -2.5, std::setfill('*'), std::setw(6), "ab");
+    CS540_TEST_SAME("%%%", std::setw(3), 'c', std::left, std::setw(3), (unsigned char)'d', std::string("str"));
+    CS540_TEST_SAME("% % %", Nested{255}, 10, Nested{16});
+    CS540_TEST_SAME("a%b%", (const char *)nullptr, 1);
+
+    // Test that InterpolateTo() appends, and starts each call from a new stream's state.
+    {
+        std::string buffer = "> ";
+        InterpolateTo(buffer, "% ", std::hex, 255);
+        InterpolateTo(buffer, "%", 255);
+        InterpolateTo(buffer, CS540_FORMAT(" %"), 1);
+        InterpolateTo(buffer, CompiledFormat(" %"), 2);
+        assert(buffer == "> ff 255 1 2");
+    }
+
+    // Test that InterpolateToString() reserves enough for the common types up front.
+    {
+        auto result = InterpolateToString("% % % % % %", std::setw(40), -1LL, std::fixed, -1e300, true, 'c', std::string(50, 's'), (void *)&argc);
+        auto reserved = result.capacity();
+        result.shrink_to_fit();
+        assert(reserved >= result.size() && reserved < 2*result.size());
+    }
+
+    // Test that InterpolateTo() keeps the classic locale's decimal point when the
+    // C locale's LC_NUMERIC uses a comma, if such a locale is installed.
+    {
+        std::string numeric = std::setlocale(LC_NUMERIC, nullptr);
+        for (auto name : {"de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8"}) {
+            if (std::setlocale(LC_NUMERIC, name)) break;
+        }
+        CS540_TEST("3.25, 1.5e+10, 0x1.8p+0", "%, %, %", 3.25, 1.5e10, std::hexfloat, 1.5);
+        std::setlocale(LC_NUMERIC, numeric.c_str());
+    }
+
+    // Test a manipulator of our own, which consumes a % sign. The second
+    // time, it is classified without being run first.
+    CS540_TEST("1\t2", "%%%", 1, tab, 2);
+    CS540_TEST("1\t2", "%%%", 1, tab, 2);
+
+    // Benchmark calls with ostream manipulators.
+    {
+        std::stringstream s;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < BENCHMARK_CALLS; i++) {
+            s.str("");
+            s << Interpolate("% % %", i, ffr(std::flush), ffr(std::endl), tab);
+        }
+        auto end = std::chrono::steady_clock::now();
+        std::cout << "std::flush, std::endl and a custom manipulator: "
+                  << std::chrono::duration<double, std::nano>(end - start).count()/BENCHMARK_CALLS
+                  << " ns/call" << std::endl;
+    }
+
+    // Benchmark a log line printed to a stream and with InterpolateTo().
+    {
+        std::stringstream s;
+        std::string buffer;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < BENCHMARK_CALLS; i++) {
+            s.str("");
+            s << Interpolate("request % from % took % ms, status %", i, "10.0.0.1", 3.25, 200);
+        }
+        auto middle = std::chrono::steady_clock::now();
+        for (int i = 0; i < BENCHMARK_CALLS; i++) {
+            buffer.clear();
+            InterpolateTo(buffer, "request % from % took % ms, status %", i, "10.0.0.1", 3.25, 200);
+        }
+        auto end = std::chrono::steady_clock::now();
+        assert(s.str() == buffer);
+        std::cout << "log line: stream="
+                  << std::chrono::duration<double, std::nano>(middle - start).count()/BENCHMARK_CALLS
+                  << " ns/call, InterpolateTo="
+                  << std::chrono::duration<double, std::nano>(end - middle).count()/BENCHMARK_CALLS
+                  << " ns/call" << std::endl;
+    }
+
+    // Benchmark a log line made into a string through a std::ostringstream and
+    // with InterpolateToString().
+    {
+        std::string line;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < BENCHMARK_CALLS; i++) {
+            std::ostringstream s;
+            s << Interpolate("request % from % took % ms, status %", i, "10.0.0.1", 3.25, 200);
+            line = s.str();
+        }
+        auto middle = std::chrono::steady_clock::now();
+        for (int i = 0; i < BENCHMARK_CALLS; i++) {
+            line = InterpolateToString("request % from % took % ms, status %", i, "10.0.0.1", 3.25, 200);
+        }
+        auto end = std::chrono::steady_clock::now();
+        assert(line == "request 99999 from 10.0.0.1 took 3.25 ms, status 200");
+        std::cout << "log line to a string: std::ostringstream="
+                  << std::chrono::duration<double, std::nano>(middle - start).count()/BENCHMARK_CALLS
+                  << " ns/call, InterpolateToString="
+                  << std::chrono::duration<double, std::nano>(end - middle).count()/BENCHMARK_CALLS
+                  << " ns/call" << std::endl;
+    }
+
     // Test space efficiency.
     {
         std::fstream out("/dev/null");
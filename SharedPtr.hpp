@@ -2,152 +2,1315 @@
 #define CS540_SHARED_PTR_HPP
 
 #include <cstddef>
+#include <cstdlib>
 
 #include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #if ATOMIC_POINTER_LOCK_FREE < 2
 #warn "std::atomic_uintptr_t is not always lock-free"
 #endif
 
 namespace cs540 {
+class AtomicCounter {
+    std::atomic_uintptr_t _count;
+
+public:
+    constexpr explicit AtomicCounter(std::uintptr_t count) noexcept : _count{count} {}
+
+    void increment(std::uintptr_t n = 1) noexcept {
+        _count.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    bool increment_if_nonzero() noexcept {
+        auto count = _count.load(std::memory_order_relaxed);
+        do {
+            if (!count) return false;
+        } while (!_count.compare_exchange_weak(count, count + 1,
+                                               std::memory_order_acq_rel,
+                                               std::memory_order_relaxed));
+        return true;
+    }
+
+    bool decrement() noexcept {
+        return _count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    bool unique() const noexcept {
+        return _count.load(std::memory_order_acquire) == 1;
+    }
+
+    std::uintptr_t load() const noexcept {
+        return _count.load(std::memory_order_relaxed);
+    }
+};
+
+class LocalCounter {
+    std::uintptr_t _count;
+
+public:
+    constexpr explicit LocalCounter(std::uintptr_t count) noexcept : _count{count} {}
+
+    LocalCounter(const LocalCounter &) = delete;
+    LocalCounter &operator=(const LocalCounter &) = delete;
+
+    void increment(std::uintptr_t n = 1) noexcept {
+        _count += n;
+    }
+
+    bool increment_if_nonzero() noexcept {
+        return _count && ++_count;
+    }
+
+    bool decrement() noexcept {
+        return !--_count;
+    }
+
+    bool unique() const noexcept {
+        return _count == 1;
+    }
+
+    std::uintptr_t load() const noexcept {
+        return _count;
+    }
+};
+
 namespace internal {
-class SharedObjectBase {
-    std::atomic_uintptr_t _counter;
+class BiasedOwner;
+}
+
+// The thread that creates the counter counts its own references without
+// atomics; other threads use a shared atomic count. The two are merged when
+// the owner's count reaches zero, or when the owner drains the counters that
+// other threads queued after taking the shared count below zero.
+class BiasedCounter {
+    friend class internal::BiasedOwner;
+
+    static constexpr std::intptr_t _MERGED = 1;
+    static constexpr std::intptr_t _QUEUED = 2;
+    static constexpr std::intptr_t _ONE = 4;
+
+    internal::BiasedOwner *const _owner;
+    std::uintptr_t _biased;
+    bool _unbiased;
+    std::atomic_intptr_t _shared;
+
+    BiasedCounter *_next;
+    void *_object;
+    void (*_expire)(void *);
+
+    static std::intptr_t _count(std::intptr_t word) noexcept {
+        return (word & ~(_MERGED | _QUEUED)) / _ONE;
+    }
+
+    static bool _last(std::intptr_t word) noexcept {
+        return (word & (_MERGED | _QUEUED)) == _MERGED && !_count(word);
+    }
+
+    bool _owned() const noexcept;
+    void _enqueue() noexcept;
+    void _merge() noexcept;
+
+public:
+    explicit BiasedCounter(std::uintptr_t count);
+
+    BiasedCounter(const BiasedCounter &) = delete;
+    BiasedCounter &operator=(const BiasedCounter &) = delete;
+
+    ~BiasedCounter();
+
+    void increment(std::uintptr_t n = 1) noexcept {
+        if (_owned() && !_unbiased) {
+            _biased += n;
+        } else {
+            _shared.fetch_add(n * _ONE, std::memory_order_relaxed);
+        }
+    }
+
+    // Until it is merged, the object cannot have been disposed of, so taking
+    // another reference is always safe.
+    bool increment_if_nonzero() noexcept {
+        if (_owned() && !_unbiased) {
+            ++_biased;
+            return true;
+        }
+        auto word = _shared.load(std::memory_order_relaxed);
+        do {
+            if ((word & _MERGED) && !_count(word)) return false;
+        } while (!_shared.compare_exchange_weak(word, word + _ONE,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_relaxed));
+        return true;
+    }
+
+    template <typename Object>
+    bool decrement(Object &object) noexcept {
+        if (_owned() && !_unbiased) {
+            if (--_biased) return false;
+            _unbiased = true;
+            return _last(_shared.fetch_or(_MERGED, std::memory_order_acq_rel) | _MERGED);
+        }
+
+        auto word = _shared.load(std::memory_order_relaxed);
+        std::intptr_t next;
+        do {
+            next = word - _ONE;
+            if (!(next & (_MERGED | _QUEUED)) && _count(next) < 0) next |= _QUEUED;
+        } while (!_shared.compare_exchange_weak(word, next,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_relaxed));
+        if ((next & _QUEUED) && !(word & _QUEUED)) {
+            _object = &object;
+            _expire = [](void *object) {
+                static_cast<Object *>(object)->expire();
+            };
+            _enqueue();
+            return false;
+        }
+        return _last(next);
+    }
+
+    std::uintptr_t load() const noexcept {
+        auto word = _shared.load(std::memory_order_relaxed);
+        auto count = _count(word);
+        if (word & _MERGED) return count;
+        if (_owned()) count += _biased;
+        return count > 0 ? count : 1;
+    }
+}; // class BiasedCounter
+
+namespace internal {
+class BiasedOwner {
+    class _Handle {
+        BiasedOwner *_owner = nullptr;
+
+    public:
+        _Handle() = default;
+        _Handle(const _Handle &) = delete;
+        _Handle &operator=(const _Handle &) = delete;
+
+        // Anything released while closing is then treated as another thread's.
+        ~_Handle() {
+            if (auto owner = _owner) {
+                _owner = nullptr;
+                owner->_close();
+                owner->release();
+            }
+        }
+
+        BiasedOwner *get() const noexcept {
+            return _owner;
+        }
+
+        BiasedOwner *make() {
+            if (!_owner) _owner = new BiasedOwner;
+            return _owner;
+        }
+    };
+
+    static _Handle &_handle() noexcept {
+        thread_local _Handle handle;
+        return handle;
+    }
+
+    std::atomic_uintptr_t _refs{1};
+    std::atomic<bool> _pending{false};
+    std::mutex _lock;
+    BiasedCounter *_queue = nullptr;
+    bool _closed = false;
+
+    BiasedOwner() = default;
+
+    void _close() noexcept {
+        {
+            std::lock_guard<std::mutex> guard{_lock};
+            _closed = true;
+        }
+        drain();
+    }
+
+public:
+    BiasedOwner(const BiasedOwner &) = delete;
+    BiasedOwner &operator=(const BiasedOwner &) = delete;
+
+    static BiasedOwner *current() noexcept {
+        return _handle().get();
+    }
+
+    static BiasedOwner *acquire() {
+        auto owner = _handle().make();
+        owner->_refs.fetch_add(1, std::memory_order_relaxed);
+        return owner;
+    }
+
+    void release() noexcept {
+        if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+
+    bool pending() const noexcept {
+        return _pending.load(std::memory_order_relaxed);
+    }
+
+    // Returns false once the owning thread has exited.
+    bool enqueue(BiasedCounter *counter) noexcept {
+        std::lock_guard<std::mutex> guard{_lock};
+        if (_closed) return false;
+        counter->_next = _queue;
+        _queue = counter;
+        _pending.store(true, std::memory_order_relaxed);
+        return true;
+    }
+
+    void drain() noexcept {
+        BiasedCounter *queue;
+        {
+            std::lock_guard<std::mutex> guard{_lock};
+            queue = _queue;
+            _queue = nullptr;
+            _pending.store(false, std::memory_order_relaxed);
+        }
+        while (queue) {
+            auto next = queue->_next;
+            queue->_merge();
+            queue = next;
+        }
+    }
+}; // class BiasedOwner
+} // namespace internal
+
+inline BiasedCounter::BiasedCounter(std::uintptr_t count) :
+    _owner{internal::BiasedOwner::acquire()}, _biased{count}, _unbiased{false}, _shared{0},
+    _next{}, _object{}, _expire{} {}
+
+inline BiasedCounter::~BiasedCounter() {
+    _owner->release();
+}
+
+inline bool BiasedCounter::_owned() const noexcept {
+    if (_owner != internal::BiasedOwner::current()) return false;
+    if (_owner->pending()) _owner->drain();
+    return true;
+}
+
+inline void BiasedCounter::_enqueue() noexcept {
+    if (!_owner->enqueue(this)) _merge();
+}
+
+// Only called by the owner, or by whoever queued this after the owner exited.
+inline void BiasedCounter::_merge() noexcept {
+    std::intptr_t add = _unbiased ? 0 : _biased * _ONE;
+    _biased = 0;
+    _unbiased = true;
+    auto word = _shared.load(std::memory_order_relaxed);
+    std::intptr_t next;
+    do {
+        next = ((word + add) | _MERGED) & ~_QUEUED;
+    } while (!_shared.compare_exchange_weak(word, next,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_relaxed));
+    if (!_count(next)) _expire(_object);
+}
+
+namespace internal {
+template <typename Counter, typename Object>
+bool decrement(Counter &counter, Object &) noexcept {
+    return counter.decrement();
+}
+
+template <typename Object>
+bool decrement(BiasedCounter &counter, Object &object) noexcept {
+    return counter.decrement(object);
+}
+
+class Reclaimable {
+public:
+    virtual void reclaim() noexcept = 0;
+
+protected:
+    ~Reclaimable() = default;
+};
+
+inline bool retire(Reclaimable *object, bool shareable) noexcept;
+
+template <typename Counter>
+struct WeakCounter {
+    using type = Counter;
+};
+
+// Weak references are rare enough that they need not be biased.
+template <>
+struct WeakCounter<BiasedCounter> {
+    using type = AtomicCounter;
+};
+
+template <typename Counter>
+class SharedObjectBase : public Reclaimable {
+    Counter _counter;
+    typename WeakCounter<Counter>::type _weak_counter;
+
+protected:
+    constexpr SharedObjectBase()
+        noexcept(std::is_nothrow_constructible<Counter, std::uintptr_t>::value) :
+        _counter{1}, _weak_counter{1} {}
+
+    virtual ~SharedObjectBase() = default;
+
+    virtual void _dispose() noexcept = 0;
+    virtual void _destroy() noexcept = 0;
+    virtual void _dispose_and_destroy() noexcept = 0;
+
+public:
+    SharedObjectBase(const SharedObjectBase &) = delete;
+    SharedObjectBase(SharedObjectBase &&) = delete;
+    SharedObjectBase &operator=(const SharedObjectBase &) = delete;
+    SharedObjectBase &operator=(SharedObjectBase &&) = delete;
+
+    void increment(std::uintptr_t n = 1) noexcept {
+        _counter.increment(n);
+    }
+
+    bool increment_if_alive() noexcept {
+        return _counter.increment_if_nonzero();
+    }
+
+    void release() noexcept {
+        if (decrement(_counter, *this) &&
+            !retire(this, !std::is_same<Counter, LocalCounter>::value)) {
+            expire();
+        }
+    }
+
+    void reclaim() noexcept override {
+        expire();
+    }
+
+    // With no weak references left, none can be made, so skip the weak count.
+    void expire() noexcept {
+        if (_weak_counter.unique()) {
+            _dispose_and_destroy();
+        } else {
+            _dispose();
+            release_weak();
+        }
+    }
+
+    void increment_weak() noexcept {
+        _weak_counter.increment();
+    }
+
+    void release_weak() noexcept {
+        if (_weak_counter.decrement()) _destroy();
+    }
+
+    std::uintptr_t count() const noexcept {
+        return _counter.load();
+    }
+
+    bool unique() const noexcept {
+        return _counter.unique();
+    }
+};
+
+template <typename T, bool = std::is_empty<T>::value && !std::is_final<T>::value>
+class Holder {
+    T _value;
+
+public:
+    template <typename U>
+    constexpr explicit Holder(U &&value) : _value(std::forward<U>(value)) {}
+
+    T &get() noexcept {
+        return _value;
+    }
+};
+
+template <typename T>
+class Holder<T, true> : private T {
+public:
+    template <typename U>
+    constexpr explicit Holder(U &&value) : T(std::forward<U>(value)) {}
+
+    T &get() noexcept {
+        return *this;
+    }
+};
+
+template <typename T, typename Deleter, typename Counter>
+class SharedObject final : public SharedObjectBase<Counter>, private Holder<Deleter> {
+    T *const _ptr;
+
+    void _dispose() noexcept override {
+        this->get()(_ptr);
+    }
+
+    void _destroy() noexcept override {
+        delete this;
+    }
+
+    void _dispose_and_destroy() noexcept override {
+        _dispose();
+        _destroy();
+    }
+
+public:
+    explicit SharedObject(T *ptr, Deleter &&deleter) :
+        Holder<Deleter>{std::move(deleter)}, _ptr{ptr} {}
+};
+
+template <typename T, typename Alloc, typename Counter>
+class SharedValue final : public SharedObjectBase<Counter>,
+                          private Holder<typename std::allocator_traits<Alloc>::template
+                                         rebind_alloc<SharedValue<T, Alloc, Counter>>> {
+public:
+    using Allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<SharedValue>;
+
+private:
+    std::aligned_storage_t<sizeof(T), alignof(T)> _storage;
+
+    void _dispose() noexcept override {
+        get()->~T();
+    }
+
+    void _destroy() noexcept override {
+        Allocator alloc{std::move(Holder<Allocator>::get())};
+        this->~SharedValue();
+        std::allocator_traits<Allocator>::deallocate(alloc, this, 1);
+    }
+
+    void _dispose_and_destroy() noexcept override {
+        _dispose();
+        _destroy();
+    }
+
+public:
+    template <typename... Args>
+    explicit SharedValue(const Allocator &alloc, Args &&...args) : Holder<Allocator>{alloc} {
+        ::new (static_cast<void *>(&_storage)) T(std::forward<Args>(args)...);
+    }
+
+    T *get() noexcept {
+        return reinterpret_cast<T *>(&_storage);
+    }
+};
+
+template <typename T, typename Counter, typename Alloc, typename... Args>
+SharedValue<T, Alloc, Counter> *allocate_shared(const Alloc &alloc, Args &&...args) {
+    using Object = SharedValue<T, Alloc, Counter>;
+    using Traits = std::allocator_traits<typename Object::Allocator>;
+    typename Object::Allocator object_alloc{alloc};
+    auto object = Traits::allocate(object_alloc, 1);
+    try {
+        ::new (static_cast<void *>(object)) Object {object_alloc, std::forward<Args>(args)...};
+    } catch (...) {
+        Traits::deallocate(object_alloc, object, 1);
+        throw;
+    }
+    return object;
+}
+
+template <std::size_t Size, std::size_t Align>
+class Pool {
+    static_assert(Align <= alignof(std::max_align_t), "over-aligned pool");
+
+    union Node {
+        Node *next;
+        alignas(Align) unsigned char storage[Size];
+    };
+
+    static constexpr std::size_t _BATCH = 64;
+
+    struct Global {
+        std::mutex lock;
+        Node *free = nullptr;
+    };
+
+    struct Cache {
+        Node *free = nullptr;
+        std::size_t size = 0;
+
+        Cache() = default;
+        Cache(const Cache &) = delete;
+        Cache &operator=(const Cache &) = delete;
+
+        ~Cache() {
+            if (free) _spill(*this, size);
+        }
+    };
+
+    static Global &_global() {
+        static Global global;
+        return global;
+    }
+
+    static Cache &_cache() {
+        thread_local Cache cache;
+        return cache;
+    }
+
+    static void _refill(Cache &cache) {
+        auto &global = _global();
+        {
+            std::lock_guard<std::mutex> guard{global.lock};
+            while (global.free && cache.size < _BATCH) {
+                auto node = global.free;
+                global.free = node->next;
+                node->next = cache.free;
+                cache.free = node;
+                ++cache.size;
+            }
+        }
+        if (cache.free) return;
+
+        auto chunk = static_cast<Node *>(std::malloc(_BATCH * sizeof(Node)));
+        if (!chunk) throw std::bad_alloc {};
+        for (std::size_t i = 0; i < _BATCH; ++i) {
+            chunk[i].next = cache.free;
+            cache.free = &chunk[i];
+        }
+        cache.size = _BATCH;
+    }
+
+    static void _spill(Cache &cache, std::size_t n) noexcept {
+        auto first = cache.free;
+        auto last = first;
+        for (std::size_t i = 1; i < n; ++i) last = last->next;
+        cache.free = last->next;
+        cache.size -= n;
+
+        auto &global = _global();
+        std::lock_guard<std::mutex> guard{global.lock};
+        last->next = global.free;
+        global.free = first;
+    }
+
+public:
+    Pool() = delete;
+
+    static void *allocate() {
+        auto &cache = _cache();
+        if (!cache.free) _refill(cache);
+        auto node = cache.free;
+        cache.free = node->next;
+        --cache.size;
+        return node;
+    }
+
+    static void deallocate(void *ptr) noexcept {
+        auto &cache = _cache();
+        auto node = static_cast<Node *>(ptr);
+        node->next = cache.free;
+        cache.free = node;
+        if (++cache.size >= 2 * _BATCH) _spill(cache, _BATCH);
+    }
+}; // template <std::size_t, std::size_t> class Pool
+
+template <typename Counter, typename T, typename Deleter = std::default_delete<T>>
+SharedObjectBase<Counter> *share(T *ptr, Deleter deleter = Deleter {}) {
+    if (!ptr) return nullptr;
+    try {
+        return new SharedObject<T, Deleter, Counter> {ptr, std::move(deleter)};
+    } catch (...) {
+        deleter(ptr);
+        throw;
+    }
+}
+
+// Finds the counts embedded in an object deriving from IntrusiveBase.
+template <typename Counter>
+constexpr SharedObjectBase<Counter> *intrusive_object(SharedObjectBase<Counter> *object) noexcept {
+    return object;
+}
+}
+
+// Destroys batches of retired objects on a background thread.
+class Reclaimer {
+    using _Batch = std::vector<internal::Reclaimable *>;
+
+    std::mutex _lock;
+    std::condition_variable _ready;
+    std::vector<_Batch> _batches;
+    bool _stopping = false;
+    std::thread _thread;
+
+    void _run() noexcept {
+        std::unique_lock<std::mutex> guard{_lock};
+        for (;;) {
+            _ready.wait(guard, [this] { return _stopping || !_batches.empty(); });
+            if (_batches.empty()) return;
+            auto batches = std::move(_batches);
+            _batches.clear();
+            guard.unlock();
+            for (auto &batch : batches) {
+                for (auto object : batch) object->reclaim();
+            }
+            guard.lock();
+        }
+    }
+
+public:
+    Reclaimer() : _thread{[this] { _run(); }} {}
+
+    Reclaimer(const Reclaimer &) = delete;
+    Reclaimer &operator=(const Reclaimer &) = delete;
+
+    // Everything submitted so far is destroyed before this returns.
+    ~Reclaimer() {
+        {
+            std::lock_guard<std::mutex> guard{_lock};
+            _stopping = true;
+        }
+        _ready.notify_one();
+        _thread.join();
+    }
+
+    void submit(_Batch &&batch) {
+        {
+            std::lock_guard<std::mutex> guard{_lock};
+            _batches.push_back(std::move(batch));
+        }
+        _ready.notify_one();
+    }
+}; // class Reclaimer
+
+// While in scope, objects whose last reference is dropped on this thread are
+// retired instead of destroyed. They wait for reclaim() or the end of the
+// scope, or are handed to a Reclaimer in batches. Objects with a LocalCounter
+// must stay on their thread, so with a Reclaimer they are destroyed at once.
+class DeferredReclamation {
+    friend bool internal::retire(internal::Reclaimable *, bool) noexcept;
+
+    std::vector<internal::Reclaimable *> _retired;
+    Reclaimer *const _reclaimer;
+    const std::size_t _batch;
+    DeferredReclamation *const _previous;
+
+    static DeferredReclamation *&_current() noexcept {
+        thread_local DeferredReclamation *current = nullptr;
+        return current;
+    }
+
+    DeferredReclamation(Reclaimer *reclaimer, std::size_t batch) :
+        _reclaimer{reclaimer}, _batch{batch}, _previous{_current()} {
+        _retired.reserve(batch);
+        _current() = this;
+    }
+
+    bool _retire(internal::Reclaimable *object, bool shareable) noexcept {
+        if (_reclaimer && !shareable) return false;
+        try {
+            _retired.push_back(object);
+        } catch (...) {
+            return false;
+        }
+        if (_reclaimer && _retired.size() >= _batch) _hand_off();
+        return true;
+    }
+
+    // On failure, the batch stays here to be reclaimed later.
+    void _hand_off() noexcept {
+        try {
+            std::vector<internal::Reclaimable *> next;
+            next.reserve(_batch);
+            _reclaimer->submit(std::move(_retired));
+            _retired.swap(next);
+        } catch (...) {}
+    }
+
+public:
+    explicit DeferredReclamation(std::size_t batch = 1024) :
+        DeferredReclamation{nullptr, batch} {}
+
+    explicit DeferredReclamation(Reclaimer &reclaimer, std::size_t batch = 1024) :
+        DeferredReclamation{&reclaimer, batch} {}
+
+    DeferredReclamation(const DeferredReclamation &) = delete;
+    DeferredReclamation &operator=(const DeferredReclamation &) = delete;
+
+    ~DeferredReclamation() {
+        if (_reclaimer && !_retired.empty()) _hand_off();
+        reclaim();
+        _current() = _previous;
+    }
+
+    std::size_t pending() const noexcept {
+        return _retired.size();
+    }
+
+    // Destroys up to n retired objects, counting any that they retire in turn.
+    std::size_t reclaim(std::size_t n = std::numeric_limits<std::size_t>::max()) noexcept {
+        std::size_t reclaimed = 0;
+        while (reclaimed < n && !_retired.empty()) {
+            auto object = _retired.back();
+            _retired.pop_back();
+            object->reclaim();
+            ++reclaimed;
+        }
+        return reclaimed;
+    }
+}; // class DeferredReclamation
+
+inline bool internal::retire(Reclaimable *object, bool shareable) noexcept {
+    auto current = DeferredReclamation::_current();
+    return current && current->_retire(object, shareable);
+}
+
+// Embeds the counts in T itself. Weak references keep the whole object alive,
+// though it can no longer be locked once the last strong reference is gone.
+template <typename T, typename Counter = AtomicCounter>
+class IntrusiveBase : public internal::SharedObjectBase<Counter> {
+    void _dispose() noexcept override {}
+
+    void _destroy() noexcept override {
+        delete static_cast<T *>(this);
+    }
+
+    void _dispose_and_destroy() noexcept override {
+        _destroy();
+    }
+
+protected:
+    IntrusiveBase() = default;
+};
+
+template <typename T, typename Counter = AtomicCounter>
+class SharedPtr;
+
+template <typename T, typename Counter = AtomicCounter>
+class WeakPtr;
+
+template <typename T>
+class IntrusivePtr;
+
+template <typename T, typename Counter = AtomicCounter>
+class EnableSharedFromThis;
+
+template <typename T>
+using LocalSharedPtr = SharedPtr<T, LocalCounter>;
+
+template <typename T>
+using LocalWeakPtr = WeakPtr<T, LocalCounter>;
+
+template <typename T>
+using BiasedSharedPtr = SharedPtr<T, BiasedCounter>;
+
+template <typename T>
+using BiasedWeakPtr = WeakPtr<T, BiasedCounter>;
+
+template <typename T, typename Counter>
+class SharedPtr {
+    template <typename, typename>
+    friend class SharedPtr;
+
+    template <typename, typename>
+    friend class WeakPtr;
+
+    using _Object = internal::SharedObjectBase<Counter>;
+
+    _Object *_object;
+    T *_base;
+
+    explicit SharedPtr(_Object *object, T *base) noexcept :
+        _object{object}, _base{base} {}
+
+    template <typename U>
+    explicit SharedPtr(const SharedPtr<U, Counter> &that, T *base) noexcept :
+        _object{that._object}, _base{base} {
+        if (_object) _object->increment();
+    }
+
+    template <typename U>
+    explicit SharedPtr(SharedPtr<U, Counter> &&that, T *base) noexcept :
+        _object{that._object}, _base{base} {
+        that._clear();
+    }
+
+    template <typename U>
+    void _copy_from(const SharedPtr<U, Counter> &that) noexcept {
+        if (static_cast<const void *>(this) != static_cast<const void *>(&that)) {
+            if (that._object) that._object->increment();
+            _release();
+            _object = that._object;
+            _base = that._base;
+        }
+    }
+
+    template <typename U>
+    void _move_from(SharedPtr<U, Counter> &&that) noexcept {
+        if (static_cast<const void *>(this) != static_cast<const void *>(&that)) {
+            _release();
+            _object = that._object;
+            _base = that._base;
+            that._clear();
+        }
+    }
+
+    void _release() noexcept {
+        if (_object) _object->release();
+    }
+
+    void _clear() noexcept {
+        _object = nullptr;
+        _base = nullptr;
+    }
+
+    template <typename U, typename V>
+    void _enable(const EnableSharedFromThis<U, Counter> *base, V *ptr) noexcept {
+        if (base && base->_weak_this.expired()) {
+            base->_weak_this = WeakPtr<U, Counter> {
+                _object, const_cast<U *>(static_cast<const U *>(ptr))
+            };
+        }
+    }
+
+    void _enable(...) noexcept {}
+
+public:
+    constexpr SharedPtr() noexcept :  _object{}, _base{} {}
+
+    constexpr explicit SharedPtr(std::nullptr_t) noexcept : SharedPtr{} {}
+
+    template <typename U>
+    explicit SharedPtr(U *ptr) : _object{internal::share<Counter>(ptr)}, _base{ptr} {
+        _enable(ptr, ptr);
+    }
+
+    template <typename U, typename Deleter>
+    SharedPtr(U *ptr, Deleter deleter) :
+        _object{internal::share<Counter>(ptr, std::move(deleter))}, _base{ptr} {
+        _enable(ptr, ptr);
+    }
+
+    SharedPtr(const SharedPtr &that) noexcept : SharedPtr{that, that._base} {}
+
+    template <typename U>
+    SharedPtr(const SharedPtr<U, Counter> &that) noexcept : SharedPtr{that, that._base} {}
+
+    SharedPtr(SharedPtr &&that) noexcept : SharedPtr{std::move(that), that._base} {}
+
+    template <typename U>
+    SharedPtr(SharedPtr<U, Counter> &&that) noexcept : SharedPtr{std::move(that), that._base} {}
+
+    // The object is its own control block, so sharing it allocates nothing.
+    template <typename U>
+    SharedPtr(const IntrusivePtr<U> &that) noexcept :
+        _object{internal::intrusive_object(that.get())}, _base{that.get()} {
+        if (_object) _object->increment();
+    }
+
+    template <typename U>
+    SharedPtr(IntrusivePtr<U> &&that) noexcept :
+        _object{internal::intrusive_object(that.get())}, _base{that.release()} {}
+
+    SharedPtr &operator=(const SharedPtr &that) noexcept {
+        _copy_from(that);
+        return *this;
+    }
 
-protected:
-    constexpr SharedObjectBase() noexcept : _counter{1} {}
+    template <typename U>
+    SharedPtr &operator=(const SharedPtr<U, Counter> &that) noexcept {
+        _copy_from(that);
+        return *this;
+    }
 
-public:
-    SharedObjectBase(const SharedObjectBase &) = delete;
-    SharedObjectBase(SharedObjectBase &&) = delete;
-    SharedObjectBase &operator=(const SharedObjectBase &) = delete;
-    SharedObjectBase &operator=(SharedObjectBase &&) = delete;
+    SharedPtr &operator=(SharedPtr &&that) noexcept {
+        _move_from(std::move(that));
+        return *this;
+    }
 
-    virtual ~SharedObjectBase() = default;
+    template <typename U>
+    SharedPtr &operator=(SharedPtr<U, Counter> &&that) noexcept {
+        _move_from(std::move(that));
+        return *this;
+    }
+
+    ~SharedPtr() {
+        _release();
+    }
 
-    auto increment() noexcept {
-        return _counter.fetch_add(1, std::memory_order_relaxed);
+    void reset() noexcept {
+        _release();
+        _clear();
     }
 
-    auto decrement() noexcept {
-        return _counter.fetch_sub(1, std::memory_order_acq_rel);
+    void reset(std::nullptr_t) noexcept {
+        reset();
     }
-};
 
-template <typename T>
-class SharedObject final : public SharedObjectBase {
-    const T *const _ptr;
+    template <typename U>
+    void reset(U *ptr) {
+        *this = SharedPtr {ptr};
+    }
+
+    template <typename U, typename Deleter>
+    void reset(U *ptr, Deleter deleter) {
+        *this = SharedPtr {ptr, std::move(deleter)};
+    }
+
+    constexpr T *get() const noexcept {
+        return _base;
+    }
+
+    T &operator*() const {
+        return *get();
+    }
+
+    constexpr T *operator->() const noexcept {
+        return get();
+    }
+
+    constexpr explicit operator bool() const noexcept {
+        return get();
+    }
+
+    // Whether this is the only strong reference.
+    bool unique() const noexcept {
+        return _object && _object->unique();
+    }
+
+    template <typename U, typename C, typename Alloc, typename... Args>
+    friend SharedPtr<U, C> AllocateShared(const Alloc &, Args &&...);
 
+    template <typename T1, typename T2, typename C>
+    friend constexpr bool operator==(const SharedPtr<T1, C> &,
+                                     const SharedPtr<T2, C> &) noexcept;
+
+    template <typename U, typename V, typename C>
+    friend SharedPtr<U, C> static_pointer_cast(const SharedPtr<V, C> &) noexcept;
+
+    template <typename U, typename V, typename C>
+    friend SharedPtr<U, C> static_pointer_cast(SharedPtr<V, C> &&) noexcept;
+
+    template <typename U, typename V, typename C>
+    friend SharedPtr<U, C> dynamic_pointer_cast(const SharedPtr<V, C> &) noexcept;
+
+    template <typename U, typename V, typename C>
+    friend SharedPtr<U, C> dynamic_pointer_cast(SharedPtr<V, C> &&) noexcept;
+}; // template <typename, typename> class SharedPtr
+
+template <typename T>
+class PoolAllocator {
 public:
-    constexpr explicit SharedObject(const T *ptr) noexcept : _ptr{ptr} {}
+    using value_type = T;
+
+    constexpr PoolAllocator() noexcept = default;
+
+    template <typename U>
+    constexpr PoolAllocator(const PoolAllocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        return n == 1
+            ? static_cast<T *>(internal::Pool<sizeof(T), alignof(T)>::allocate())
+            : std::allocator<T> {}.allocate(n);
+    }
 
-    ~SharedObject() override {
-        delete _ptr;
+    void deallocate(T *ptr, std::size_t n) noexcept {
+        if (n == 1) {
+            internal::Pool<sizeof(T), alignof(T)>::deallocate(ptr);
+        } else {
+            std::allocator<T> {}.deallocate(ptr, n);
+        }
     }
 };
 
-template <typename T>
-SharedObjectBase *share(const T *ptr) {
-    return ptr ? new SharedObject<T> {ptr} : nullptr;
+template <typename T, typename U>
+constexpr bool operator==(const PoolAllocator<T> &, const PoolAllocator<U> &) noexcept {
+    return true;
+}
+
+template <typename T, typename U>
+constexpr bool operator!=(const PoolAllocator<T> &, const PoolAllocator<U> &) noexcept {
+    return false;
 }
+
+template <typename T, typename Counter = AtomicCounter, typename Alloc, typename... Args>
+SharedPtr<T, Counter> AllocateShared(const Alloc &alloc, Args &&...args) {
+    auto object = internal::allocate_shared<T, Counter>(alloc, std::forward<Args>(args)...);
+    SharedPtr<T, Counter> sp {
+        static_cast<internal::SharedObjectBase<Counter> *>(object), object->get()
+    };
+    sp._enable(sp._base, sp._base);
+    return sp;
 }
 
-template <typename T>
-class SharedPtr {
-    template <typename>
+template <typename T, typename Counter = AtomicCounter, typename... Args>
+SharedPtr<T, Counter> MakeShared(Args &&...args) {
+    return AllocateShared<T, Counter>(std::allocator<std::remove_cv_t<T>> {},
+                                      std::forward<Args>(args)...);
+}
+
+template <typename T1, typename T2, typename Counter>
+constexpr bool operator==(const SharedPtr<T1, Counter> &sp1,
+                          const SharedPtr<T2, Counter> &sp2) noexcept {
+    return sp1._object == sp2._object;
+}
+
+template <typename T, typename Counter>
+constexpr bool operator==(const SharedPtr<T, Counter> &sp, std::nullptr_t) noexcept {
+    return !sp;
+}
+
+template <typename T, typename Counter>
+constexpr bool operator==(std::nullptr_t, const SharedPtr<T, Counter> &sp) noexcept {
+    return !sp;
+}
+
+template <typename T1, typename T2, typename Counter>
+constexpr bool operator!=(const SharedPtr<T1, Counter> &sp1,
+                          const SharedPtr<T2, Counter> &sp2) noexcept {
+    return !(sp1 == sp2);
+}
+
+template <typename T, typename Counter>
+constexpr bool operator!=(const SharedPtr<T, Counter> &sp, std::nullptr_t) noexcept {
+    return static_cast<bool>(sp);
+}
+
+template <typename T, typename Counter>
+constexpr bool operator!=(std::nullptr_t, const SharedPtr<T, Counter> &sp) noexcept {
+    return static_cast<bool>(sp);
+}
+
+template <typename T, typename U, typename Counter>
+SharedPtr<T, Counter> static_pointer_cast(const SharedPtr<U, Counter> &sp) noexcept {
+    return SharedPtr<T, Counter> {sp, static_cast<T *>(sp._base)};
+}
+
+template <typename T, typename U, typename Counter>
+SharedPtr<T, Counter> static_pointer_cast(SharedPtr<U, Counter> &&sp) noexcept {
+    return SharedPtr<T, Counter> {std::move(sp), static_cast<T *>(sp._base)};
+}
+
+template <typename T, typename U, typename Counter>
+SharedPtr<T, Counter> dynamic_pointer_cast(const SharedPtr<U, Counter> &sp) noexcept {
+    auto base = dynamic_cast<T *>(sp._base);
+    return base ? SharedPtr<T, Counter> {sp, base} : SharedPtr<T, Counter> {};
+}
+
+template <typename T, typename U, typename Counter>
+SharedPtr<T, Counter> dynamic_pointer_cast(SharedPtr<U, Counter> &&sp) noexcept {
+    auto base = dynamic_cast<T *>(sp._base);
+    return base ? SharedPtr<T, Counter> {std::move(sp), base} : SharedPtr<T, Counter> {};
+}
+
+template <typename T, typename Counter>
+class WeakPtr {
+    template <typename, typename>
     friend class SharedPtr;
 
-    internal::SharedObjectBase *_object;
+    template <typename, typename>
+    friend class WeakPtr;
+
+    template <typename, typename>
+    friend class EnableSharedFromThis;
+
+    internal::SharedObjectBase<Counter> *_object;
     T *_base;
 
+    explicit WeakPtr(internal::SharedObjectBase<Counter> *object, T *base) noexcept :
+        _object{object}, _base{base} {
+        _object->increment_weak();
+    }
+
+    void _release() noexcept {
+        if (_object) _object->release_weak();
+    }
+
+    void _clear() noexcept {
+        _object = nullptr;
+        _base = nullptr;
+    }
+
+public:
+    constexpr WeakPtr() noexcept : _object{}, _base{} {}
+
     template <typename U>
-    explicit SharedPtr(const SharedPtr<U> &that, T *base) noexcept :
-        _object{that._object}, _base{base} {
-        if (_object) _object->increment();
+    WeakPtr(const SharedPtr<U, Counter> &that) noexcept : _object{that._object}, _base{that._base} {
+        if (_object) _object->increment_weak();
+    }
+
+    WeakPtr(const WeakPtr &that) noexcept : _object{that._object}, _base{that._base} {
+        if (_object) _object->increment_weak();
     }
 
+    // Converting a possibly dangling pointer may need to read its vtable, so lock first.
     template <typename U>
-    explicit SharedPtr(SharedPtr<U> &&that, T *base) noexcept :
-        _object{that._object}, _base{base} {
+    WeakPtr(const WeakPtr<U, Counter> &that) noexcept : WeakPtr{that.lock()} {}
+
+    WeakPtr(WeakPtr &&that) noexcept : _object{that._object}, _base{that._base} {
         that._clear();
     }
 
-    template <typename U>
-    void _copy_from(const SharedPtr<U> &that) noexcept {
-        if (static_cast<const void *>(this) != static_cast<const void *>(&that)) {
-            if (that._object) that._object->increment();
+    WeakPtr &operator=(const WeakPtr &that) noexcept {
+        if (this != &that) {
+            if (that._object) that._object->increment_weak();
             _release();
             _object = that._object;
             _base = that._base;
         }
+        return *this;
     }
 
     template <typename U>
-    void _move_from(SharedPtr<U> &&that) noexcept {
-        _object = that._object;
-        _base = that._base;
-        that._clear();
+    WeakPtr &operator=(const WeakPtr<U, Counter> &that) noexcept {
+        return *this = WeakPtr {that};
     }
 
-    void _release() noexcept {
-        if (_object && _object->decrement() == 1) {
-            delete _object;
+    template <typename U>
+    WeakPtr &operator=(const SharedPtr<U, Counter> &that) noexcept {
+        return *this = WeakPtr {that};
+    }
+
+    WeakPtr &operator=(WeakPtr &&that) noexcept {
+        if (this != &that) {
+            _release();
+            _object = that._object;
+            _base = that._base;
+            that._clear();
         }
+        return *this;
     }
 
-    void _clear() noexcept {
-        _object = nullptr;
-        _base = nullptr;
+    ~WeakPtr() {
+        _release();
+    }
+
+    void reset() noexcept {
+        _release();
+        _clear();
+    }
+
+    bool expired() const noexcept {
+        return !_object || !_object->count();
+    }
+
+    SharedPtr<T, Counter> lock() const noexcept {
+        return _object && _object->increment_if_alive()
+            ? SharedPtr<T, Counter> {_object, _base}
+            : SharedPtr<T, Counter> {};
     }
+}; // template <typename, typename> class WeakPtr
 
+class BadWeakPtr : public std::logic_error {
 public:
-    constexpr SharedPtr() noexcept :  _object{}, _base{} {}
+    BadWeakPtr() : logic_error{"bad weak pointer"} {}
+};
 
-    constexpr explicit SharedPtr(std::nullptr_t) noexcept : SharedPtr{} {}
+template <typename T, typename Counter>
+class EnableSharedFromThis {
+    template <typename, typename>
+    friend class SharedPtr;
+
+    mutable WeakPtr<T, Counter> _weak_this;
+
+protected:
+    constexpr EnableSharedFromThis() noexcept = default;
+
+    // Copies are owned separately, so they must not share the original's owner.
+    EnableSharedFromThis(const EnableSharedFromThis &) noexcept {}
+
+    EnableSharedFromThis &operator=(const EnableSharedFromThis &) noexcept {
+        return *this;
+    }
+
+    ~EnableSharedFromThis() = default;
+
+public:
+    SharedPtr<T, Counter> shared_from_this() {
+        auto sp = _weak_this.lock();
+        if (!sp) throw BadWeakPtr {};
+        return sp;
+    }
+
+    SharedPtr<const T, Counter> shared_from_this() const {
+        auto sp = _weak_this.lock();
+        if (!sp) throw BadWeakPtr {};
+        return sp;
+    }
+
+    WeakPtr<T, Counter> weak_from_this() noexcept {
+        return _weak_this;
+    }
+
+    // Built from the same control block, so an expired owner stays expired
+    // rather than becoming empty.
+    WeakPtr<const T, Counter> weak_from_this() const noexcept {
+        return _weak_this._object
+            ? WeakPtr<const T, Counter> {_weak_this._object, _weak_this._base}
+            : WeakPtr<const T, Counter> {};
+    }
+}; // template <typename, typename> class EnableSharedFromThis
+
+template <typename T>
+class IntrusivePtr {
+    T *_ptr;
+
+    void _release() noexcept {
+        if (_ptr) internal::intrusive_object(_ptr)->release();
+    }
+
+public:
+    constexpr IntrusivePtr() noexcept : _ptr{} {}
+
+    constexpr explicit IntrusivePtr(std::nullptr_t) noexcept : IntrusivePtr{} {}
 
+    // Takes over the reference that a newly constructed object starts with.
     template <typename U>
-    explicit SharedPtr(U *ptr) : _object{internal::share(ptr)}, _base{ptr} {}
+    explicit IntrusivePtr(U *ptr) noexcept : _ptr{ptr} {}
 
-    SharedPtr(const SharedPtr &that) noexcept : SharedPtr{that, that._base} {}
+    IntrusivePtr(const IntrusivePtr &that) noexcept : _ptr{that._ptr} {
+        if (_ptr) internal::intrusive_object(_ptr)->increment();
+    }
 
     template <typename U>
-    SharedPtr(const SharedPtr<U> &that) noexcept : SharedPtr{that, that._base} {}
+    IntrusivePtr(const IntrusivePtr<U> &that) noexcept : _ptr{that.get()} {
+        if (_ptr) internal::intrusive_object(_ptr)->increment();
+    }
 
-    SharedPtr(SharedPtr &&that) noexcept : SharedPtr{std::move(that), that._base} {}
+    IntrusivePtr(IntrusivePtr &&that) noexcept : _ptr{that.release()} {}
 
     template <typename U>
-    SharedPtr(SharedPtr<U> &&that) noexcept : SharedPtr{std::move(that), that._base} {}
+    IntrusivePtr(IntrusivePtr<U> &&that) noexcept : _ptr{that.release()} {}
 
-    SharedPtr &operator=(const SharedPtr &that) noexcept {
-        _copy_from(that);
-        return *this;
+    IntrusivePtr &operator=(const IntrusivePtr &that) noexcept {
+        return *this = IntrusivePtr {that};
     }
 
     template <typename U>
-    SharedPtr &operator=(const SharedPtr<U> &that) noexcept {
-        _copy_from(that);
-        return *this;
+    IntrusivePtr &operator=(const IntrusivePtr<U> &that) noexcept {
+        return *this = IntrusivePtr {that};
     }
 
-    SharedPtr &operator=(SharedPtr &&that) noexcept {
-        _move_from(std::move(that));
+    IntrusivePtr &operator=(IntrusivePtr &&that) noexcept {
+        if (this != &that) {
+            _release();
+            _ptr = that.release();
+        }
         return *this;
     }
 
     template <typename U>
-    SharedPtr &operator=(SharedPtr<U> &&that) noexcept {
-        _move_from(std::move(that));
+    IntrusivePtr &operator=(IntrusivePtr<U> &&that) noexcept {
+        _release();
+        _ptr = that.release();
         return *this;
     }
 
-    ~SharedPtr() {
+    ~IntrusivePtr() {
         _release();
     }
 
     void reset() noexcept {
         _release();
-        _clear();
+        _ptr = nullptr;
     }
 
     void reset(std::nullptr_t) noexcept {
@@ -155,15 +1318,20 @@ public:
     }
 
     template <typename U>
-    void reset(U *ptr) {
-        auto new_object = internal::share(ptr);
+    void reset(U *ptr) noexcept {
         _release();
-        _object = new_object;
-        _base = ptr;
+        _ptr = ptr;
+    }
+
+    // Gives up the reference without dropping it.
+    T *release() noexcept {
+        auto ptr = _ptr;
+        _ptr = nullptr;
+        return ptr;
     }
 
     constexpr T *get() const noexcept {
-        return _base;
+        return _ptr;
     }
 
     T &operator*() const {
@@ -177,77 +1345,194 @@ public:
     constexpr explicit operator bool() const noexcept {
         return get();
     }
+}; // template <typename> class IntrusivePtr
 
-    template <typename T1, typename T2>
-    friend constexpr bool operator==(const SharedPtr<T1> &,
-                                     const SharedPtr<T2> &) noexcept;
-
-    template <typename U, typename V>
-    friend SharedPtr<U> static_pointer_cast(const SharedPtr<V> &) noexcept;
-
-    template <typename U, typename V>
-    friend SharedPtr<U> static_pointer_cast(SharedPtr<V> &&) noexcept;
-
-    template <typename U, typename V>
-    friend SharedPtr<U> dynamic_pointer_cast(const SharedPtr<V> &) noexcept;
-
-    template <typename U, typename V>
-    friend SharedPtr<U> dynamic_pointer_cast(SharedPtr<V> &&) noexcept;
-}; // template <typename> class SharedPtr
+template <typename T, typename... Args>
+IntrusivePtr<T> MakeIntrusive(Args &&...args) {
+    return IntrusivePtr<T> {new T(std::forward<Args>(args)...)};
+}
 
 template <typename T1, typename T2>
-constexpr bool operator==(const SharedPtr<T1> &sp1,
-                          const SharedPtr<T2> &sp2) noexcept {
-    return sp1._object == sp2._object;
+constexpr bool operator==(const IntrusivePtr<T1> &ip1, const IntrusivePtr<T2> &ip2) noexcept {
+    return internal::intrusive_object(ip1.get()) == internal::intrusive_object(ip2.get());
 }
 
 template <typename T>
-constexpr bool operator==(const SharedPtr<T> &sp, std::nullptr_t) noexcept {
-    return sp;
+constexpr bool operator==(const IntrusivePtr<T> &ip, std::nullptr_t) noexcept {
+    return !ip;
 }
 
 template <typename T>
-constexpr bool operator==(std::nullptr_t, const SharedPtr<T> &sp) noexcept {
-    return sp;
+constexpr bool operator==(std::nullptr_t, const IntrusivePtr<T> &ip) noexcept {
+    return !ip;
 }
 
 template <typename T1, typename T2>
-constexpr bool operator!=(const SharedPtr<T1> &sp1,
-                          const SharedPtr<T2> &sp2) noexcept {
-    return !(sp1 == sp2);
+constexpr bool operator!=(const IntrusivePtr<T1> &ip1, const IntrusivePtr<T2> &ip2) noexcept {
+    return !(ip1 == ip2);
 }
 
 template <typename T>
-constexpr bool operator!=(const SharedPtr<T> &sp, std::nullptr_t) noexcept {
-    return !sp;
+constexpr bool operator!=(const IntrusivePtr<T> &ip, std::nullptr_t) noexcept {
+    return static_cast<bool>(ip);
 }
 
 template <typename T>
-constexpr bool operator!=(std::nullptr_t, const SharedPtr<T> &sp) noexcept {
-    return !sp;
+constexpr bool operator!=(std::nullptr_t, const IntrusivePtr<T> &ip) noexcept {
+    return static_cast<bool>(ip);
 }
 
 template <typename T, typename U>
-SharedPtr<T> static_pointer_cast(const SharedPtr<U> &sp) noexcept {
-    return SharedPtr<T> {sp, static_cast<T *>(sp._base)};
+IntrusivePtr<T> static_pointer_cast(const IntrusivePtr<U> &ip) noexcept {
+    return IntrusivePtr<T> {static_cast<T *>(IntrusivePtr<U> {ip}.release())};
 }
 
 template <typename T, typename U>
-SharedPtr<T> static_pointer_cast(SharedPtr<U> &&sp) noexcept {
-    return SharedPtr<T> {std::move(sp), static_cast<T *>(sp._base)};
+IntrusivePtr<T> static_pointer_cast(IntrusivePtr<U> &&ip) noexcept {
+    return IntrusivePtr<T> {static_cast<T *>(ip.release())};
 }
 
 template <typename T, typename U>
-SharedPtr<T> dynamic_pointer_cast(const SharedPtr<U> &sp) noexcept {
-    auto base = dynamic_cast<T *>(sp._base);
-    return base ? SharedPtr<T> {sp, base} : SharedPtr<T> {};
+IntrusivePtr<T> dynamic_pointer_cast(const IntrusivePtr<U> &ip) noexcept {
+    auto ptr = dynamic_cast<T *>(ip.get());
+    return ptr ? static_pointer_cast<T>(ip) : IntrusivePtr<T> {};
 }
 
 template <typename T, typename U>
-SharedPtr<T> dynamic_pointer_cast(SharedPtr<U> &&sp) noexcept {
-    auto base = dynamic_cast<T *>(sp._base);
-    return base ? SharedPtr<T> {std::move(sp), base} : SharedPtr<T> {};
+IntrusivePtr<T> dynamic_pointer_cast(IntrusivePtr<U> &&ip) noexcept {
+    auto ptr = dynamic_cast<T *>(ip.get());
+    if (!ptr) return IntrusivePtr<T> {};
+    ip.release();
+    return IntrusivePtr<T> {ptr};
 }
+
+template <typename T>
+class AtomicSharedPtr {
+    static_assert(sizeof(std::uintptr_t) == 8, "AtomicSharedPtr needs 64-bit pointers");
+
+    using _Value = SharedPtr<T>;
+    using _Alloc = PoolAllocator<_Value>;
+    using _Node = internal::SharedValue<_Value, _Alloc, AtomicCounter>;
+
+    // User-space addresses fit in 48 bits, so the top 16 bits of the word
+    // count loaders that have pinned the node but not yet let go of it.
+    static constexpr unsigned _SHIFT = 48;
+    static constexpr std::uintptr_t _PIN = std::uintptr_t{1} << _SHIFT;
+    static constexpr std::uintptr_t _MASK = _PIN - 1;
+
+    mutable std::atomic_uintptr_t _word;
+
+    static _Node *_node(std::uintptr_t word) noexcept {
+        return reinterpret_cast<_Node *>(word & _MASK);
+    }
+
+    static std::uintptr_t _make(_Value &&value) {
+        return value
+            ? reinterpret_cast<std::uintptr_t>(
+                internal::allocate_shared<_Value, AtomicCounter>(_Alloc {}, std::move(value)))
+            : 0;
+    }
+
+    static bool _equal(const _Value *current, const _Value &expected) noexcept {
+        return current
+            ? *current == expected && current->get() == expected.get()
+            : !expected;
+    }
+
+    // Hands each pin on a replaced word over as a reference to its node, and
+    // drops the reference the word itself held.
+    static void _retire(std::uintptr_t word) noexcept {
+        auto node = _node(word);
+        if (!node) return;
+        auto pins = word >> _SHIFT;
+        if (pins) {
+            node->increment(pins - 1);
+        } else {
+            node->release();
+        }
+    }
+
+    std::uintptr_t _pin() const noexcept {
+        return _word.fetch_add(_PIN, std::memory_order_acquire) + _PIN;
+    }
+
+    void _unpin(_Node *node) const noexcept {
+        auto word = _word.load(std::memory_order_relaxed);
+        while (_node(word) == node && word >> _SHIFT) {
+            if (_word.compare_exchange_weak(word, word - _PIN,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        if (node) node->release();
+    }
+
+public:
+    constexpr AtomicSharedPtr() noexcept : _word{0} {}
+
+    explicit AtomicSharedPtr(_Value desired) : _word{_make(std::move(desired))} {}
+
+    AtomicSharedPtr(const AtomicSharedPtr &) = delete;
+    AtomicSharedPtr &operator=(const AtomicSharedPtr &) = delete;
+
+    ~AtomicSharedPtr() {
+        _retire(_word.load(std::memory_order_relaxed));
+    }
+
+    bool is_lock_free() const noexcept {
+        return _word.is_lock_free();
+    }
+
+    _Value load() const noexcept {
+        auto node = _node(_pin());
+        _Value value = node ? *node->get() : _Value {};
+        _unpin(node);
+        return value;
+    }
+
+    void store(_Value desired) {
+        _retire(_word.exchange(_make(std::move(desired)), std::memory_order_acq_rel));
+    }
+
+    _Value exchange(_Value desired) {
+        auto word = _word.exchange(_make(std::move(desired)), std::memory_order_acq_rel);
+        auto node = _node(word);
+        _Value value = node ? *node->get() : _Value {};
+        _retire(word);
+        return value;
+    }
+
+    bool compare_exchange_strong(_Value &expected, _Value desired) {
+        std::uintptr_t replacement = 0;
+        while (true) {
+            auto word = _pin();
+            auto node = _node(word);
+            const _Value *current = node ? node->get() : nullptr;
+            if (!_equal(current, expected)) {
+                expected = current ? *current : _Value {};
+                _unpin(node);
+                _retire(replacement);
+                return false;
+            }
+            if (!replacement) replacement = _make(std::move(desired));
+            while (_node(word) == node) {
+                if (_word.compare_exchange_weak(word, replacement,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_relaxed)) {
+                    _retire(word);
+                    if (node) node->release();
+                    return true;
+                }
+            }
+            _unpin(node);
+        }
+    }
+
+    bool compare_exchange_weak(_Value &expected, _Value desired) {
+        return compare_exchange_strong(expected, std::move(desired));
+    }
+}; // template <typename> class AtomicSharedPtr
 }
 
 #endif // CS540_SHARED_PTR_HPP
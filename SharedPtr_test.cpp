@@ -17,6 +17,8 @@
 #include <iostream>
 #include <algorithm>
 #include <random>
+#include <atomic>
+#include <vector>
 #include <errno.h>
 #include <assert.h>
 
@@ -46,10 +48,25 @@ Random::Random(unsigned int seed) : gen(seed) {}
 
 void basic_tests_1();
 void basic_tests_2();
+void basic_tests_3();
+void basic_tests_4();
+void basic_tests_5();
+void basic_tests_6();
+void basic_tests_7();
+void basic_tests_8();
+void basic_tests_9();
+void basic_tests_10();
+void basic_tests_11();
 // RunSecs needs to be here so that it can be set via command-line arg.
 int RunSecs = 15;
 void threaded_test();
+void atomic_test();
+void counter_test();
+void deleter_test();
+void intrusive_test();
+void reclaim_test();
 size_t AllocatedSpace;
+size_t AllocationCount;
 
 
 
@@ -100,13 +117,28 @@ main(int argc, char *argv[]) {
 
     basic_tests_1();
     basic_tests_2();
+    basic_tests_3();
+    basic_tests_4();
+    basic_tests_5();
+    basic_tests_6();
+    basic_tests_7();
+    basic_tests_8();
+    basic_tests_9();
+    basic_tests_10();
+    basic_tests_11();
     threaded_test();
+    atomic_test();
+    counter_test();
+    deleter_test();
+    intrusive_test();
+    reclaim_test();
 }
 
 void *operator new(size_t sz) {
     char *p = (char *) malloc(sz + 8);
     *((size_t *) p) = sz;
     __sync_add_and_fetch(&AllocatedSpace, sz);
+    __sync_add_and_fetch(&AllocationCount, 1);
     return p + 8;
 }
 
@@ -619,6 +651,782 @@ basic_tests_2() {
     printf("Basic tests 2 passed.\n");
 }
 
+/* Basic Tests 3 ================================================================================ */
+
+class Made {
+    public:
+        Made(int i, const char *s) : value(i), name(s) {}
+        virtual ~Made() {}
+        int value;
+        const char *name;
+};
+
+class Made_derived : public Made {
+    public:
+        Made_derived(int i) : Made(i, "derived") {}
+};
+
+size_t CountingAllocations;
+
+template <typename T>
+class CountingAllocator {
+    public:
+        typedef T value_type;
+        CountingAllocator() {}
+        template <typename U>
+        CountingAllocator(const CountingAllocator<U> &) {}
+        T *allocate(size_t n) {
+            CountingAllocations++;
+            return std::allocator<T>().allocate(n);
+        }
+        void deallocate(T *p, size_t n) {
+            CountingAllocations--;
+            std::allocator<T>().deallocate(p, n);
+        }
+};
+
+template <typename T, typename U>
+bool operator==(const CountingAllocator<T> &, const CountingAllocator<U> &) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const CountingAllocator<T> &, const CountingAllocator<U> &) {
+    return false;
+}
+
+// Tests for the factory functions.
+void
+basic_tests_3() {
+
+    size_t base = AllocatedSpace;
+    {
+        // Test that MakeShared allocates exactly once.
+        {
+            size_t count = AllocationCount;
+            SharedPtr<Made> sp = MakeShared<Made>(1234, "made");
+            assert(AllocationCount == count + 1);
+            assert(sp->value == 1234);
+            assert(sp->name != 0);
+
+            // Copies share the same object.
+            SharedPtr<Made> sp2(sp);
+            assert(sp2 == sp);
+            assert(sp2.get() == sp.get());
+            assert(AllocationCount == count + 1);
+        }
+
+        // Test MakeShared with conversions and casts.
+        {
+            SharedPtr<Made> sp = MakeShared<Made_derived>(5678);
+            SharedPtr<Made_derived> sp2 = dynamic_pointer_cast<Made_derived>(sp);
+            assert(sp2);
+            assert(sp2->value == 5678);
+            sp.reset();
+            assert(sp2->value == 5678);
+        }
+
+        // Test MakeShared with a const type.
+        {
+            SharedPtr<const Made> sp = MakeShared<const Made>(1, "const");
+            assert(sp->value == 1);
+        }
+
+        // Test that AllocateShared goes through the given allocator only.
+        {
+            size_t count = AllocationCount;
+            {
+                SharedPtr<Made> sp = AllocateShared<Made>(CountingAllocator<Made>(), 42, "counted");
+                assert(CountingAllocations == 1);
+                SharedPtr<Made> sp2(sp);
+                sp.reset();
+                assert(CountingAllocations == 1);
+                assert(sp2->value == 42);
+            }
+            assert(CountingAllocations == 0);
+            assert(AllocationCount == count + 1);
+        }
+
+        // Test that pooled objects are recycled without touching operator new.
+        {
+            SharedPtr<Made> warm = AllocateShared<Made>(PoolAllocator<Made>(), 0, "warm");
+            Made *first = warm.get();
+            warm.reset();
+            size_t count = AllocationCount;
+            for (int i = 0; i < 1000; i++) {
+                SharedPtr<Made> sp = AllocateShared<Made>(PoolAllocator<Made>(), i, "pooled");
+                assert(sp->value == i);
+                assert(sp.get() == first);
+            }
+            SharedPtr<Made> sp = AllocateShared<Made>(PoolAllocator<Made>(), 1, "pooled");
+            SharedPtr<Made> sp2 = AllocateShared<Made>(PoolAllocator<Made>(), 2, "pooled");
+            assert(sp.get() != sp2.get());
+            assert(AllocationCount == count);
+        }
+    }
+    if (base != AllocatedSpace) {
+        printf("Leaked %zu bytes in basic tests 3.\n", AllocatedSpace - base);
+        abort();
+    }
+
+    printf("Basic tests 3 passed.\n");
+}
+
+/* Basic Tests 4 ================================================================================ */
+
+class Watched {
+    public:
+        Watched(bool *d) : destroyed(d) {
+            *destroyed = false;
+        }
+        virtual ~Watched() {
+            *destroyed = true;
+        }
+        bool *destroyed;
+};
+
+class Watched_derived : public Watched {
+    public:
+        Watched_derived(bool *d) : Watched(d) {}
+};
+
+// Tests for WeakPtr.
+void
+basic_tests_4() {
+
+    size_t base = AllocatedSpace;
+    {
+        // Test default construction.
+        {
+            WeakPtr<Watched> wp;
+            assert(wp.expired());
+            assert(!wp.lock());
+        }
+
+        // Test lock and expiry with a separately allocated object.
+        {
+            bool destroyed;
+            WeakPtr<Watched> wp;
+            {
+                SharedPtr<Watched> sp(new Watched(&destroyed));
+                wp = sp;
+                assert(!wp.expired());
+                SharedPtr<Watched> sp2 = wp.lock();
+                assert(sp2 == sp);
+                assert(sp2.get() == sp.get());
+            }
+            assert(destroyed);
+            assert(wp.expired());
+            assert(!wp.lock());
+        }
+
+        // Test that the object is destroyed at strong-count zero, while the
+        // block made by MakeShared lives until the last WeakPtr.
+        {
+            bool destroyed;
+            SharedPtr<Watched> sp = MakeShared<Watched>(&destroyed);
+            size_t space = AllocatedSpace;
+            WeakPtr<Watched> wp(sp);
+            WeakPtr<Watched> wp2(wp);
+            sp.reset();
+            assert(destroyed);
+            assert(wp.expired() && wp2.expired());
+            assert(AllocatedSpace == space);
+            wp.reset();
+            assert(AllocatedSpace == space);
+            wp2 = wp;
+            assert(AllocatedSpace < space);
+        }
+
+        // Test conversions, moves and copies.
+        {
+            bool destroyed;
+            SharedPtr<Watched_derived> sp = MakeShared<Watched_derived>(&destroyed);
+            WeakPtr<Watched_derived> wp(sp);
+            WeakPtr<Watched> wp2(wp);
+            WeakPtr<Watched> wp3(std::move(wp2));
+            assert(wp2.expired());
+            wp2 = wp;
+            SharedPtr<Watched> sp2 = wp3.lock();
+            assert(sp2.get() == sp.get());
+            assert(wp2.lock().get() == sp.get());
+            sp.reset();
+            assert(!destroyed);
+            sp2.reset();
+            assert(destroyed);
+            assert(wp.expired() && wp2.expired() && wp3.expired());
+            // Converting from an expired WeakPtr must not touch the object.
+            WeakPtr<Watched> wp4(wp);
+            assert(wp4.expired());
+        }
+    }
+    if (base != AllocatedSpace) {
+        printf("Leaked %zu bytes in basic tests 4.\n", AllocatedSpace - base);
+        abort();
+    }
+
+    printf("Basic tests 4 passed.\n");
+}
+
+/* Basic Tests 5 ================================================================================ */
+
+// Tests for AtomicSharedPtr.
+void
+basic_tests_5() {
+
+    size_t base = AllocatedSpace;
+    {
+        bool d1, d2, d3;
+        SharedPtr<Watched> sp1(new Watched(&d1));
+        SharedPtr<Watched> sp2(new Watched(&d2));
+
+        // Test default construction, load and store.
+        {
+            AtomicSharedPtr<Watched> asp;
+            assert(asp.is_lock_free());
+            assert(!asp.load());
+            asp.store(sp1);
+            assert(asp.load() == sp1);
+            asp.store(SharedPtr<Watched>());
+            assert(!asp.load());
+        }
+
+        // Test exchange.
+        {
+            AtomicSharedPtr<Watched> asp(sp1);
+            SharedPtr<Watched> old = asp.exchange(sp2);
+            assert(old == sp1);
+            assert(asp.load() == sp2);
+        }
+
+        // Test compare_exchange.
+        {
+            AtomicSharedPtr<Watched> asp(sp1);
+            SharedPtr<Watched> expected = sp2;
+            assert(!asp.compare_exchange_strong(expected, sp2));
+            assert(expected == sp1);
+            assert(asp.compare_exchange_strong(expected, sp2));
+            assert(asp.load() == sp2);
+            expected.reset();
+            assert(!asp.compare_exchange_weak(expected, sp1));
+            assert(expected == sp2);
+        }
+
+        // Test that the stored value is released.
+        {
+            AtomicSharedPtr<Watched> asp(SharedPtr<Watched>(new Watched(&d3)));
+            assert(!d3);
+            asp.store(sp1);
+            assert(d3);
+        }
+        assert(!d1 && !d2);
+    }
+    if (base != AllocatedSpace) {
+        printf("Leaked %zu bytes in basic tests 5.\n", AllocatedSpace - base);
+        abort();
+    }
+
+    printf("Basic tests 5 passed.\n");
+}
+
+/* Basic Tests 6 ================================================================================ */
+
+// Tests for LocalSharedPtr, which shares everything but the counter.
+void
+basic_tests_6() {
+
+    size_t base = AllocatedSpace;
+    {
+        bool destroyed;
+        {
+            LocalSharedPtr<Watched> sp(new Watched(&destroyed));
+            LocalSharedPtr<Watched> sp2(sp);
+            LocalWeakPtr<Watched> wp(sp);
+            sp.reset();
+            assert(!destroyed);
+            assert(wp.lock() == sp2);
+            sp2 = LocalSharedPtr<Watched>();
+            assert(destroyed);
+            assert(wp.expired());
+        }
+        {
+            LocalSharedPtr<Watched> sp = MakeShared<Watched_derived, LocalCounter>(&destroyed);
+            LocalSharedPtr<Watched_derived> sp2 = dynamic_pointer_cast<Watched_derived>(sp);
+            LocalSharedPtr<Watched_derived> sp3 = static_pointer_cast<Watched_derived>(std::move(sp));
+            assert(!sp);
+            assert(sp2 == sp3);
+            assert(sp2 != nullptr);
+            sp2.reset();
+            assert(!destroyed);
+        }
+        assert(destroyed);
+        {
+            LocalSharedPtr<Made> sp = AllocateShared<Made, LocalCounter>(PoolAllocator<Made>(), 7, "local");
+            assert(sp->value == 7);
+        }
+    }
+    if (base != AllocatedSpace) {
+        printf("Leaked %zu bytes in basic tests 6.\n", AllocatedSpace - base);
+        abort();
+    }
+
+    printf("Basic tests 6 passed.\n");
+}
+
+/* Basic Tests 7 ================================================================================ */
+
+BiasedSharedPtr<Watched> *Handoff;
+
+void *
+create_handoff(void *vp) {
+    *Handoff = BiasedSharedPtr<Watched>(new Watched((bool *) vp));
+    BiasedSharedPtr<Watched> copy(*Handoff);
+    return NULL;
+}
+
+void *
+drop_handoff(void *) {
+    BiasedSharedPtr<Watched> copy(*Handoff);
+    copy.reset();
+    Handoff->reset();
+    return NULL;
+}
+
+// Tests for BiasedSharedPtr, particularly handing objects between threads.
+void
+basic_tests_7() {
+
+    {
+        // Force the owner record for this thread to be allocated, so that
+        // memory-leak detecting will work right.
+        BiasedSharedPtr<int> p(new int);
+    }
+
+    size_t base = AllocatedSpace;
+    {
+        int ec;
+        pthread_t tid;
+        bool destroyed;
+        Handoff = new BiasedSharedPtr<Watched>;
+
+        // Test on the owning thread alone.
+        {
+            BiasedSharedPtr<Watched> sp(new Watched(&destroyed));
+            BiasedSharedPtr<Watched> sp2(sp);
+            BiasedWeakPtr<Watched> wp(sp);
+            sp.reset();
+            assert(wp.lock() == sp2);
+            sp2.reset();
+            assert(destroyed);
+            assert(wp.expired());
+        }
+
+        // Created on a thread that has since exited, released here.
+        {
+            ec = pthread_create(&tid, 0, create_handoff, &destroyed); assert(ec == 0);
+            pthread_join(tid, NULL);
+            assert(!destroyed);
+            BiasedWeakPtr<Watched> wp(*Handoff);
+            Handoff->reset();
+            assert(destroyed);
+            assert(wp.expired());
+        }
+
+        // Created here, released on another thread. The release is queued
+        // until this thread next touches a biased counter it owns.
+        {
+            BiasedSharedPtr<Watched> other(new Watched(&destroyed));
+            *Handoff = BiasedSharedPtr<Watched>(new Watched(&destroyed));
+            ec = pthread_create(&tid, 0, drop_handoff, 0); assert(ec == 0);
+            pthread_join(tid, NULL);
+            assert(!destroyed);
+            BiasedSharedPtr<Watched> copy(other);
+            assert(destroyed);
+            destroyed = false;
+        }
+        assert(destroyed);
+
+        delete Handoff;
+    }
+    if (base != AllocatedSpace) {
+        printf("Leaked %zu bytes in basic tests 7.\n", AllocatedSpace - base);
+        abort();
+    }
+
+    printf("Basic tests 7 passed.\n");
+}
+
+/* Basic Tests 8 ================================================================================ */
+
+int Deletions;
+
+struct CountingDeleter {
+    void operator()(Watched *p) const {
+        Deletions++;
+        delete p;
+    }
+};
+
+class StatefulDeleter {
+    public:
+        StatefulDeleter(int *c) : count(c) {}
+        void operator()(Watched *p) const {
+            ++*count;
+            delete p;
+        }
+    private:
+        int *count;
+};
+
+void
+delete_watched(Watched *p) {
+    Deletions++;
+    delete p;
+}
+
+// Tests for custom deleters.
+void
+basic_tests_8() {
+
+    size_t base = AllocatedSpace;
+    {
+        bool destroyed;
+
+        // Stateless deleters must not take up space in the control block.
+        assert(sizeof(internal::SharedObject<Watched, CountingDeleter, AtomicCounter>)
+         == sizeof(internal::SharedObject<Watched, std::default_delete<Watched>, AtomicCounter>));
+
+        // Test a stateless deleter.
+        {
+            Deletions = 0;
+            {
+                SharedPtr<Watched> sp(new Watched(&destroyed), CountingDeleter());
+                SharedPtr<Watched> sp2(sp);
+                sp.reset();
+                assert(Deletions == 0 && !destroyed);
+            }
+            assert(Deletions == 1 && destroyed);
+        }
+
+        // Test a stateful deleter, going through a WeakPtr.
+        {
+            int count = 0;
+            WeakPtr<Watched> wp;
+            {
+                SharedPtr<Watched> sp(new Watched(&destroyed), StatefulDeleter(&count));
+                wp = sp;
+            }
+            assert(count == 1 && destroyed);
+            assert(wp.expired());
+        }
+
+        // Test a function pointer, a lambda, and reset.
+        {
+            Deletions = 0;
+            SharedPtr<Watched> sp(new Watched(&destroyed), delete_watched);
+            sp.reset(new Watched(&destroyed), [](Watched *p) {
+                Deletions += 10;
+                delete p;
+            });
+            assert(Deletions == 1);
+            sp.reset();
+            assert(Deletions == 11);
+        }
+
+        // Test a deleter that does not free anything.
+        {
+            Watched w(&destroyed);
+            {
+                SharedPtr<Watched> sp(&w, [](Watched *) {});
+            }
+            assert(!destroyed);
+        }
+    }
+    if (base != AllocatedSpace) {
+        printf("Leaked %zu bytes in basic tests 8.\n", AllocatedSpace - base);
+        abort();
+    }
+
+    printf("Basic tests 8 passed.\n");
+}
+
+/* Basic Tests 9 ================================================================================ */
+
+class Counted : public IntrusiveBase<Counted> {
+    public:
+        Counted(bool *d) : destroyed(d) { *destroyed = false; }
+        virtual ~Counted() { *destroyed = true; }
+    private:
+        bool *const destroyed;
+};
+
+class Counted_derived : public Counted {
+    public:
+        Counted_derived(bool *d) : Counted(d) {}
+};
+
+class LocalCounted : public IntrusiveBase<LocalCounted, LocalCounter> {
+    public:
+        LocalCounted(int v) : value(v) {}
+        int value;
+};
+
+// Tests for IntrusivePtr.
+void
+basic_tests_9() {
+
+    size_t base = AllocatedSpace;
+    {
+        bool destroyed;
+
+        static_assert(sizeof(IntrusivePtr<Counted>) == sizeof(Counted *), "");
+
+        // Test copying, moving, and reset.
+        {
+            IntrusivePtr<Counted> ip(new Counted(&destroyed));
+            {
+                IntrusivePtr<Counted> ip2(ip);
+                IntrusivePtr<Counted> ip3(std::move(ip2));
+                assert(!ip2 && ip3 == ip);
+            }
+            assert(!destroyed);
+            ip.reset(new Counted(&destroyed));
+            ip.reset();
+            assert(destroyed);
+            assert(ip == nullptr && !(nullptr != ip));
+        }
+
+        // Test casts.
+        {
+            IntrusivePtr<Counted_derived> ip = MakeIntrusive<Counted_derived>(&destroyed);
+            IntrusivePtr<Counted> base_ip(ip);
+            assert(base_ip == ip);
+            IntrusivePtr<Counted_derived> ip2 = static_pointer_cast<Counted_derived>(base_ip);
+            assert(ip2.get() == ip.get());
+            IntrusivePtr<Counted_derived> ip3 = dynamic_pointer_cast<Counted_derived>(base_ip);
+            assert(ip3.get() == ip.get());
+            IntrusivePtr<Counted> other(new Counted(&destroyed));
+            assert(!dynamic_pointer_cast<Counted_derived>(other));
+            assert(!dynamic_pointer_cast<Counted_derived>(std::move(other)));
+            assert(other);
+            IntrusivePtr<Counted_derived> ip4 = dynamic_pointer_cast<Counted_derived>(std::move(base_ip));
+            assert(!base_ip && ip4 == ip);
+        }
+
+        // Test sharing with SharedPtr and WeakPtr without allocating.
+        {
+            IntrusivePtr<Counted> ip(new Counted(&destroyed));
+            size_t count = AllocationCount;
+            WeakPtr<Counted> wp;
+            {
+                SharedPtr<Counted> sp(ip);
+                SharedPtr<Counted> sp2(std::move(ip));
+                assert(!ip && sp == sp2);
+                wp = sp;
+                assert(count == AllocationCount);
+            }
+            assert(wp.expired() && !wp.lock());
+            assert(!destroyed);
+            wp.reset();
+            assert(destroyed);
+        }
+
+        // Test a local counter.
+        {
+            IntrusivePtr<LocalCounted> ip = MakeIntrusive<LocalCounted>(1);
+            LocalSharedPtr<LocalCounted> sp(ip);
+            assert(sp->value == 1);
+        }
+    }
+    if (base != AllocatedSpace) {
+        printf("Leaked %zu bytes in basic tests 9.\n", AllocatedSpace - base);
+        abort();
+    }
+
+    printf("Basic tests 9 passed.\n");
+}
+
+/* Basic Tests 10 =============================================================================== */
+
+struct Chained : public Watched {
+    Chained(bool *d, SharedPtr<Watched> n) : Watched(d), next(std::move(n)) {}
+    SharedPtr<Watched> next;
+};
+
+// Tests for deferred reclamation.
+void
+basic_tests_10() {
+
+    size_t base = AllocatedSpace;
+    {
+        bool destroyed1, destroyed2;
+
+        // Test reclaiming in steps, including objects retired while reclaiming.
+        {
+            DeferredReclamation deferred;
+            SharedPtr<Watched> sp(new Chained(&destroyed1,
+                                              SharedPtr<Watched>(new Watched(&destroyed2))));
+            WeakPtr<Watched> wp(sp);
+            sp.reset();
+            assert(!destroyed1 && deferred.pending() == 1);
+            assert(wp.expired());
+            assert(deferred.reclaim(1) == 1);
+            assert(destroyed1 && !destroyed2 && deferred.pending() == 1);
+            assert(deferred.reclaim() == 1);
+            assert(destroyed2 && deferred.pending() == 0);
+        }
+
+        // Test reclaiming at the end of the scope, and nesting.
+        {
+            {
+                DeferredReclamation outer;
+                SharedPtr<Watched> sp1(new Watched(&destroyed1));
+                {
+                    DeferredReclamation inner;
+                    SharedPtr<Watched> sp2(new Watched(&destroyed2));
+                    sp1.reset();
+                    sp2.reset();
+                    assert(inner.pending() == 2 && outer.pending() == 0);
+                }
+                assert(destroyed1 && destroyed2);
+                sp1.reset(new Watched(&destroyed1));
+                sp1.reset();
+                assert(!destroyed1 && outer.pending() == 1);
+            }
+            assert(destroyed1);
+        }
+
+        // Test handing batches to a reclaimer.
+        {
+            const int n = 1000;
+            bool destroyed[n];
+            {
+                Reclaimer reclaimer;
+                {
+                    DeferredReclamation deferred(reclaimer, 64);
+                    for (int i = 0; i < n; i++) {
+                        SharedPtr<Watched> sp(new Watched(&destroyed[i]));
+                    }
+                    assert(deferred.pending() < 64);
+
+                    // Local counts must not be handed to another thread.
+                    LocalSharedPtr<Watched> lsp(new Watched(&destroyed1));
+                    lsp.reset();
+                    assert(destroyed1);
+                }
+            }
+            for (int i = 0; i < n; i++) {
+                assert(destroyed[i]);
+            }
+        }
+    }
+    if (base != AllocatedSpace) {
+        printf("Leaked %zu bytes in basic tests 10.\n", AllocatedSpace - base);
+        abort();
+    }
+
+    printf("Basic tests 10 passed.\n");
+}
+
+/* Basic Tests 11 =============================================================================== */
+
+class Handler : public Watched, public EnableSharedFromThis<Handler> {
+    public:
+        Handler(bool *d) : Watched(d) {}
+};
+
+class Handler_derived : public Handler {
+    public:
+        Handler_derived(bool *d) : Handler(d) {}
+};
+
+class LocalHandler : public EnableSharedFromThis<LocalHandler, LocalCounter> {};
+
+// Counts every operation on a strong or weak count.
+class CountingCounter : public LocalCounter {
+    public:
+        static size_t operations;
+        explicit CountingCounter(std::uintptr_t count) : LocalCounter(count) {}
+        void increment(std::uintptr_t n = 1) { operations++; LocalCounter::increment(n); }
+        bool increment_if_nonzero() { operations++; return LocalCounter::increment_if_nonzero(); }
+        bool decrement() { operations++; return LocalCounter::decrement(); }
+};
+size_t CountingCounter::operations;
+
+class CountedHandler : public EnableSharedFromThis<CountedHandler, CountingCounter> {};
+
+// Tests for EnableSharedFromThis.
+void
+basic_tests_11() {
+
+    size_t base = AllocatedSpace;
+    {
+        bool destroyed;
+
+        // Test a raw pointer, including through a derived class.
+        {
+            SharedPtr<Handler> sp(new Handler_derived(&destroyed));
+            size_t count = AllocationCount;
+            SharedPtr<Handler> sp2 = sp->shared_from_this();
+            assert(count == AllocationCount);
+            assert(sp2 == sp && sp2.get() == sp.get());
+            sp.reset();
+            assert(!destroyed);
+            const Handler &h = *sp2;
+            SharedPtr<const Handler> sp3 = h.shared_from_this();
+            assert(sp3 == sp2);
+            WeakPtr<Handler> wp = sp2->weak_from_this();
+            sp2.reset();
+            sp3.reset();
+            assert(destroyed && wp.expired());
+        }
+
+        // Test MakeShared, reset, and a local counter.
+        {
+            SharedPtr<Handler> sp = MakeShared<Handler>(&destroyed);
+            assert(sp->shared_from_this() == sp);
+            sp.reset(new Handler(&destroyed));
+            assert(sp->shared_from_this() == sp);
+            LocalSharedPtr<LocalHandler> lsp = MakeShared<LocalHandler, LocalCounter>();
+            assert(lsp->shared_from_this() == lsp);
+        }
+
+        // Test that each call touches a count only once.
+        {
+            SharedPtr<CountedHandler, CountingCounter> sp = MakeShared<CountedHandler, CountingCounter>();
+            const CountedHandler &h = *sp;
+            size_t operations = CountingCounter::operations;
+            SharedPtr<CountedHandler, CountingCounter> sp2 = sp->shared_from_this();
+            assert(CountingCounter::operations == operations + 1);
+            SharedPtr<const CountedHandler, CountingCounter> sp3 = h.shared_from_this();
+            assert(CountingCounter::operations == operations + 2);
+            WeakPtr<const CountedHandler, CountingCounter> wp = h.weak_from_this();
+            assert(CountingCounter::operations == operations + 3);
+            assert(wp.lock() == sp);
+        }
+
+        // Test an object that is not owned, and a copy of one that is.
+        {
+            Handler h(&destroyed);
+            try {
+                h.shared_from_this();
+                assert(false);
+            } catch (BadWeakPtr &) {}
+            assert(h.weak_from_this().expired());
+
+            SharedPtr<Handler> sp(new Handler(&destroyed));
+            Handler copy(*sp);
+            assert(copy.weak_from_this().expired());
+        }
+    }
+    if (base != AllocatedSpace) {
+        printf("Leaked %zu bytes in basic tests 11.\n", AllocatedSpace - base);
+        abort();
+    }
+
+    printf("Basic tests 11 passed.\n");
+}
+
 /* Threaded Test * ============================================================================== */
 
 // These need to be global so the threads can access it.
@@ -632,19 +1440,25 @@ class TestObj {
         int a;
 };
 
+template <typename C>
 struct TableEntry {
     TableEntry();
     ~TableEntry();
     pthread_mutex_t lock;
-    SharedPtr<TestObj> *ptr;
-} *Table;
+    SharedPtr<TestObj, C> *ptr;
+};
+
+template <typename C>
+TableEntry<C> *Table;
 
-TableEntry::TableEntry() : ptr(0) {
+template <typename C>
+TableEntry<C>::TableEntry() : ptr(0) {
     int ec;
     ec = pthread_mutex_init(&lock, 0);
     assert(ec == 0);
 }
-TableEntry::~TableEntry() {
+template <typename C>
+TableEntry<C>::~TableEntry() {
     int ec;
     ec = pthread_mutex_destroy(&lock);
     assert(ec == 0);
@@ -654,6 +1468,7 @@ TableEntry::~TableEntry() {
     }
 }
 
+template <typename C>
 void *
 run(void *vp) {
 
@@ -674,12 +1489,16 @@ run(void *vp) {
                 {
                     int i = rand(0, TABLE_SIZE - 1);
                     // printf("%d: new %d start\n", (int)tid, i);
-                    ec = pthread_mutex_lock(&Table[i].lock); assert(ec == 0);
-                    if (Table[i].ptr != 0) {
-                        Table[i].ptr->reset(new TestObj); // fix
+                    ec = pthread_mutex_lock(&Table<C>[i].lock); assert(ec == 0);
+                    if (Table<C>[i].ptr != 0) {
+                        if (rand(0, 1) == 0) {
+                            Table<C>[i].ptr->reset(new TestObj); // fix
+                        } else {
+                            *Table<C>[i].ptr = AllocateShared<TestObj, C>(PoolAllocator<TestObj>());
+                        }
                         counters.assignment_new++;
                     }
-                    ec = pthread_mutex_unlock(&Table[i].lock); assert(ec == 0);
+                    ec = pthread_mutex_unlock(&Table<C>[i].lock); assert(ec == 0);
                     // printf("%d: new %d done\n", (int) tid, i);
                 }
                 break;
@@ -688,12 +1507,12 @@ run(void *vp) {
                 {
                     int i = rand(0, TABLE_SIZE - 1);
                     // printf("%d: clear %d start\n", (int) tid, i);
-                    ec = pthread_mutex_lock(&Table[i].lock); assert(ec == 0);
-                    if (Table[i].ptr != 0) {
-                        Table[i].ptr->reset();
+                    ec = pthread_mutex_lock(&Table<C>[i].lock); assert(ec == 0);
+                    if (Table<C>[i].ptr != 0) {
+                        Table<C>[i].ptr->reset();
                         counters.reset++;
                     }
-                    ec = pthread_mutex_unlock(&Table[i].lock); assert(ec == 0);
+                    ec = pthread_mutex_unlock(&Table<C>[i].lock); assert(ec == 0);
                     // printf("%d: clear %d done\n", (int) tid, i);
                 }
                 break;
@@ -707,23 +1526,23 @@ run(void *vp) {
 
                     // Order to avoid deadlock.
                     if (i <= j) {
-                        ec = pthread_mutex_lock(&Table[i].lock); assert(ec == 0);
+                        ec = pthread_mutex_lock(&Table<C>[i].lock); assert(ec == 0);
                         if (i != j) {
-                            ec = pthread_mutex_lock(&Table[j].lock); assert(ec == 0);
+                            ec = pthread_mutex_lock(&Table<C>[j].lock); assert(ec == 0);
                         }
                     } else {
-                        ec = pthread_mutex_lock(&Table[j].lock); assert(ec == 0);
-                        ec = pthread_mutex_lock(&Table[i].lock); assert(ec == 0);
+                        ec = pthread_mutex_lock(&Table<C>[j].lock); assert(ec == 0);
+                        ec = pthread_mutex_lock(&Table<C>[i].lock); assert(ec == 0);
                     }
 
-                    if (Table[i].ptr && Table[j].ptr) {
-                        *Table[i].ptr = *Table[j].ptr;
+                    if (Table<C>[i].ptr && Table<C>[j].ptr) {
+                        *Table<C>[i].ptr = *Table<C>[j].ptr;
                         counters.assignment++;
                     }
 
-                    ec = pthread_mutex_unlock(&Table[i].lock); assert(ec == 0);
+                    ec = pthread_mutex_unlock(&Table<C>[i].lock); assert(ec == 0);
                     if (i != j) {
-                        ec = pthread_mutex_unlock(&Table[j].lock); assert(ec == 0);
+                        ec = pthread_mutex_unlock(&Table<C>[j].lock); assert(ec == 0);
                     }
                     // printf("%d: assign %d=%d done\n", (int) tid, i, j);
                 }
@@ -734,12 +1553,12 @@ run(void *vp) {
                     // Create with default.
                     if (rand(0, 1) == 0) {
                         int i = rand(0, TABLE_SIZE - 1);
-                        ec = pthread_mutex_lock(&Table[i].lock); assert(ec == 0);
-                        if (!Table[i].ptr) {
-                            Table[i].ptr = new SharedPtr<TestObj>;
+                        ec = pthread_mutex_lock(&Table<C>[i].lock); assert(ec == 0);
+                        if (!Table<C>[i].ptr) {
+                            Table<C>[i].ptr = new SharedPtr<TestObj, C>;
                             counters.new_default++;
                         }
-                        ec = pthread_mutex_unlock(&Table[i].lock); assert(ec == 0);
+                        ec = pthread_mutex_unlock(&Table<C>[i].lock); assert(ec == 0);
                     // Create with copy constructor.
                     } else {
                         int i = rand(0, TABLE_SIZE - 1), j;
@@ -749,20 +1568,20 @@ run(void *vp) {
 
                         // Order to avoid deadlock.
                         if (i < j) {
-                            ec = pthread_mutex_lock(&Table[i].lock); assert(ec == 0);
-                            ec = pthread_mutex_lock(&Table[j].lock); assert(ec == 0);
+                            ec = pthread_mutex_lock(&Table<C>[i].lock); assert(ec == 0);
+                            ec = pthread_mutex_lock(&Table<C>[j].lock); assert(ec == 0);
                         } else {
-                            ec = pthread_mutex_lock(&Table[j].lock); assert(ec == 0);
-                            ec = pthread_mutex_lock(&Table[i].lock); assert(ec == 0);
+                            ec = pthread_mutex_lock(&Table<C>[j].lock); assert(ec == 0);
+                            ec = pthread_mutex_lock(&Table<C>[i].lock); assert(ec == 0);
                         }
 
-                        if (!Table[i].ptr && Table[j].ptr) {
-                            Table[i].ptr = new SharedPtr<TestObj>(*Table[j].ptr);
+                        if (!Table<C>[i].ptr && Table<C>[j].ptr) {
+                            Table<C>[i].ptr = new SharedPtr<TestObj, C>(*Table<C>[j].ptr);
                             counters.new_copy++;
                         }
 
-                        ec = pthread_mutex_unlock(&Table[i].lock); assert(ec == 0);
-                        ec = pthread_mutex_unlock(&Table[j].lock); assert(ec == 0);
+                        ec = pthread_mutex_unlock(&Table<C>[i].lock); assert(ec == 0);
+                        ec = pthread_mutex_unlock(&Table<C>[j].lock); assert(ec == 0);
                         // printf("%d: assign %d=%d done\n", (int) tid, i, j);
                     }
                 }
@@ -771,13 +1590,13 @@ run(void *vp) {
                 // Delete
                 {
                     int i = rand(0, TABLE_SIZE - 1);
-                    ec = pthread_mutex_lock(&Table[i].lock); assert(ec == 0);
-                    if (Table[i].ptr) {
-                        delete Table[i].ptr;
-                        Table[i].ptr = 0;
+                    ec = pthread_mutex_lock(&Table<C>[i].lock); assert(ec == 0);
+                    if (Table<C>[i].ptr) {
+                        delete Table<C>[i].ptr;
+                        Table<C>[i].ptr = 0;
                         counters.delet++;
                     }
-                    ec = pthread_mutex_unlock(&Table[i].lock); assert(ec == 0);
+                    ec = pthread_mutex_unlock(&Table<C>[i].lock); assert(ec == 0);
                 }
                 break;
             default:
@@ -797,37 +1616,344 @@ run(void *vp) {
     return NULL;
 }
 
+template <typename C>
 void
-threaded_test() {
+threaded_test(const char *name) {
 
     int ec;
 
     size_t base = AllocatedSpace;
 
-    Table = new TableEntry[TABLE_SIZE];
+    Table<C> = new TableEntry<C>[TABLE_SIZE];
 
-    printf("Running threaded test for %d seconds.\n", RunSecs);
+    printf("Running threaded test with %s for %d seconds.\n", name, RunSecs);
 
     StartTime = time(NULL);
     pthread_t tid1, tid2, tid3, tid4;
-    ec = pthread_create(&tid1, 0, run, (void *) 1); assert(ec == 0);
-    ec = pthread_create(&tid2, 0, run, (void *) 2); assert(ec == 0);
-    ec = pthread_create(&tid3, 0, run, (void *) 3); assert(ec == 0);
-    ec = pthread_create(&tid4, 0, run, (void *) 3); assert(ec == 0);
+    ec = pthread_create(&tid1, 0, run<C>, (void *) 1); assert(ec == 0);
+    ec = pthread_create(&tid2, 0, run<C>, (void *) 2); assert(ec == 0);
+    ec = pthread_create(&tid3, 0, run<C>, (void *) 3); assert(ec == 0);
+    ec = pthread_create(&tid4, 0, run<C>, (void *) 3); assert(ec == 0);
 
     pthread_join(tid1, NULL);
     pthread_join(tid2, NULL);
     pthread_join(tid3, NULL);
     pthread_join(tid4, NULL);
 
-    delete [] Table;
+    delete [] Table<C>;
 
     if (base != AllocatedSpace) {
-        printf("Leaked %zu bytes in threaded test.\n", AllocatedSpace - base);
+        printf("Leaked %zu bytes in threaded test with %s.\n", AllocatedSpace - base, name);
         abort();
     }
 }
 
+void
+threaded_test() {
+    threaded_test<AtomicCounter>("SharedPtr");
+    threaded_test<BiasedCounter>("BiasedSharedPtr");
+}
+
+
+
+/* Atomic Test ================================================================================== */
+
+// Compares snapshot publishing through AtomicSharedPtr against a mutex-guarded
+// SharedPtr, with one writer and several readers.
+
+const int SNAPSHOT_LOADS = 1000000;
+const int SNAPSHOT_READERS = 4;
+
+class Snapshot {
+    public:
+        Snapshot(int v) : value(v), check(-v) {}
+        int value, check;
+};
+
+AtomicSharedPtr<Snapshot> *AtomicSnapshot;
+SharedPtr<Snapshot> *LockedSnapshot;
+pthread_mutex_t SnapshotLock = PTHREAD_MUTEX_INITIALIZER;
+std::atomic<bool> Publishing;
+
+void *
+load_atomic(void *) {
+    for (int i = 0; i < SNAPSHOT_LOADS; i++) {
+        SharedPtr<Snapshot> sp = AtomicSnapshot->load();
+        assert(sp && sp->value == -sp->check);
+    }
+    return NULL;
+}
+
+void *
+load_locked(void *) {
+    int ec;
+    for (int i = 0; i < SNAPSHOT_LOADS; i++) {
+        ec = pthread_mutex_lock(&SnapshotLock); assert(ec == 0);
+        SharedPtr<Snapshot> sp = *LockedSnapshot;
+        ec = pthread_mutex_unlock(&SnapshotLock); assert(ec == 0);
+        assert(sp && sp->value == -sp->check);
+    }
+    return NULL;
+}
+
+void *
+publish_atomic(void *) {
+    for (int i = 1; Publishing; i++) {
+        AtomicSnapshot->store(MakeShared<Snapshot>(i));
+    }
+    return NULL;
+}
+
+void *
+publish_locked(void *) {
+    int ec;
+    for (int i = 1; Publishing; i++) {
+        SharedPtr<Snapshot> sp = MakeShared<Snapshot>(i), old;
+        ec = pthread_mutex_lock(&SnapshotLock); assert(ec == 0);
+        old = std::move(*LockedSnapshot);
+        *LockedSnapshot = std::move(sp);
+        ec = pthread_mutex_unlock(&SnapshotLock); assert(ec == 0);
+    }
+    return NULL;
+}
+
+double
+run_snapshot_test(void *(*load)(void *), void *(*publish)(void *)) {
+
+    int ec;
+    pthread_t writer, readers[SNAPSHOT_READERS];
+    struct timespec start, end;
+
+    Publishing = true;
+    ec = pthread_create(&writer, 0, publish, 0); assert(ec == 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < SNAPSHOT_READERS; i++) {
+        ec = pthread_create(&readers[i], 0, load, 0); assert(ec == 0);
+    }
+    for (int i = 0; i < SNAPSHOT_READERS; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    Publishing = false;
+    pthread_join(writer, NULL);
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+    return double(SNAPSHOT_LOADS)*SNAPSHOT_READERS/secs;
+}
+
+void
+atomic_test() {
+
+    size_t base = AllocatedSpace;
+
+    AtomicSnapshot = new AtomicSharedPtr<Snapshot>(MakeShared<Snapshot>(0));
+    LockedSnapshot = new SharedPtr<Snapshot>(MakeShared<Snapshot>(0));
+
+    double atomic_rate = run_snapshot_test(load_atomic, publish_atomic);
+    double locked_rate = run_snapshot_test(load_locked, publish_locked);
+    printf("Snapshot loads with %d readers: AtomicSharedPtr=%.0f ops/sec, mutex=%.0f ops/sec\n",
+     SNAPSHOT_READERS, atomic_rate, locked_rate);
+
+    delete AtomicSnapshot;
+    delete LockedSnapshot;
+
+    if (base != AllocatedSpace) {
+        printf("Leaked %zu bytes in atomic test.\n", AllocatedSpace - base);
+        abort();
+    }
+}
+
+
+
+/* Counter Test ================================================================================= */
+
+// Compares copying and destroying SharedPtr and LocalSharedPtr on one thread.
+
+const int COUNTER_COPIES = 5000000;
+
+template <typename P>
+double
+copy_rate(const P &sp) {
+
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < COUNTER_COPIES; i++) {
+        P copy(sp);
+        assert(copy);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+    return COUNTER_COPIES/secs;
+}
+
+void
+counter_test() {
+
+    double atomic_rate = copy_rate(MakeShared<TestObj>(1));
+    double local_rate = copy_rate(MakeShared<TestObj, LocalCounter>(1));
+    double biased_rate = copy_rate(MakeShared<TestObj, BiasedCounter>(1));
+    printf("Copies: SharedPtr=%.0f ops/sec, LocalSharedPtr=%.0f ops/sec, BiasedSharedPtr=%.0f ops/sec\n",
+     atomic_rate, local_rate, biased_rate);
+}
+
+
+
+/* Deleter Test ================================================================================= */
+
+// Compares control block sizes and create/destroy throughput with and without
+// custom deleters.
+
+const int DELETER_OBJECTS = 1000000;
+
+struct TestObjDeleter {
+    void operator()(TestObj *p) const {
+        delete p;
+    }
+};
+
+void
+delete_test_obj(TestObj *p) {
+    delete p;
+}
+
+template <typename F>
+double
+create_rate(F make) {
+
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < DELETER_OBJECTS; i++) {
+        auto sp = make();
+        assert(sp);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+    return DELETER_OBJECTS/secs;
+}
+
+void
+deleter_test() {
+
+    printf("Control block sizes: default=%zu, stateless deleter=%zu, function pointer=%zu, MakeShared=%zu\n",
+     sizeof(internal::SharedObject<TestObj, std::default_delete<TestObj>, AtomicCounter>),
+     sizeof(internal::SharedObject<TestObj, TestObjDeleter, AtomicCounter>),
+     sizeof(internal::SharedObject<TestObj, void (*)(TestObj *), AtomicCounter>),
+     sizeof(internal::SharedValue<TestObj, std::allocator<TestObj>, AtomicCounter>));
+
+    double default_rate = create_rate([] {
+        return SharedPtr<TestObj>(new TestObj);
+    });
+    double stateless_rate = create_rate([] {
+        return SharedPtr<TestObj>(new TestObj, TestObjDeleter());
+    });
+    double pointer_rate = create_rate([] {
+        return SharedPtr<TestObj>(new TestObj, delete_test_obj);
+    });
+    double made_rate = create_rate([] {
+        return MakeShared<TestObj>();
+    });
+    printf("Create/destroy: default=%.0f ops/sec, stateless deleter=%.0f ops/sec, function pointer=%.0f ops/sec, MakeShared=%.0f ops/sec\n",
+     default_rate, stateless_rate, pointer_rate, made_rate);
+}
+
+
+
+/* Intrusive Test =============================================================================== */
+
+// Compares IntrusivePtr with SharedPtr.
+
+class IntrusiveTestObj : public IntrusiveBase<IntrusiveTestObj> {
+    public:
+        IntrusiveTestObj() : id(0) {}
+        int id;
+};
+
+void
+intrusive_test() {
+
+    printf("Sizes: SharedPtr=%zu, IntrusivePtr=%zu\n",
+     sizeof(SharedPtr<TestObj>), sizeof(IntrusivePtr<IntrusiveTestObj>));
+
+    double made_rate = create_rate([] {
+        return MakeShared<TestObj>();
+    });
+    double intrusive_rate = create_rate([] {
+        return MakeIntrusive<IntrusiveTestObj>();
+    });
+    printf("Create/destroy: MakeShared=%.0f ops/sec, MakeIntrusive=%.0f ops/sec\n",
+     made_rate, intrusive_rate);
+
+    double shared_copies = copy_rate(MakeShared<TestObj>(1));
+    double intrusive_copies = copy_rate(MakeIntrusive<IntrusiveTestObj>());
+    printf("Copies: SharedPtr=%.0f ops/sec, IntrusivePtr=%.0f ops/sec\n",
+     shared_copies, intrusive_copies);
+}
+
+
+
+/* Reclaim Test ================================================================================= */
+
+// Measures how long the thread that clears a large container of pointers is
+// stalled, with and without deferred reclamation.
+
+const int RECLAIM_OBJECTS = 1000000;
+
+double
+clear_secs(std::vector<SharedPtr<TestObj>> &sps) {
+
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sps.clear();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+}
+
+void
+reclaim_test() {
+
+    std::vector<SharedPtr<TestObj>> sps;
+    auto fill = [&sps] {
+        for (int i = 0; i < RECLAIM_OBJECTS; i++) {
+            sps.push_back(SharedPtr<TestObj>(new TestObj));
+        }
+    };
+
+    fill();
+    double immediate = clear_secs(sps);
+
+    fill();
+    double deferred, slice = 0;
+    {
+        DeferredReclamation scope;
+        deferred = clear_secs(sps);
+        while (scope.pending()) {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            scope.reclaim(1024);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            slice = std::max(slice, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9);
+        }
+    }
+
+    fill();
+    double handed_off;
+    {
+        Reclaimer reclaimer;
+        DeferredReclamation scope(reclaimer);
+        handed_off = clear_secs(sps);
+    }
+
+    printf("Clearing %d pointers stalls the caller: immediate=%.1f ms, deferred=%.1f ms "
+     "(longest reclaim of 1024=%.2f ms), reclaimer=%.1f ms\n",
+     RECLAIM_OBJECTS, immediate*1e3, deferred*1e3, slice*1e3, handed_off*1e3);
+}
+
 
 
 /* Local Variables: */
@@ -0,0 +1,388 @@
+#ifndef CS540_THREAD_POOL_HPP
+#define CS540_THREAD_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Function.hpp"
+#include "SharedPtr.hpp"
+
+namespace cs540 {
+class ThreadPool;
+
+namespace internal {
+// What a Completion waits on: the number of tasks still to run and the first
+// exception any of them threw.
+class TaskState {
+    std::atomic_size_t _remaining;
+    std::mutex _lock;
+    std::condition_variable _finished;
+    std::exception_ptr _error;
+
+public:
+    explicit TaskState(std::size_t count) noexcept : _remaining{count} {}
+
+    bool done() const noexcept {
+        return !_remaining.load(std::memory_order_acquire);
+    }
+
+    void fail(std::exception_ptr error) noexcept {
+        std::lock_guard<std::mutex> guard{_lock};
+        if (!_error) _error = std::move(error);
+    }
+
+    void finish() noexcept {
+        if (_remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        std::lock_guard<std::mutex> guard{_lock};
+        _finished.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> guard{_lock};
+        _finished.wait(guard, [this] { return done(); });
+        if (_error) std::rethrow_exception(_error);
+    }
+};
+
+struct Task {
+    Function<void()> function;
+    SharedPtr<TaskState> state;
+};
+
+// The Chase-Lev deque: its owner pushes and takes at the bottom, and other
+// threads steal from the top. Buffers it outgrows are kept until it is
+// destroyed, since a thief may still be reading one.
+class WorkDeque {
+    struct _Buffer {
+        const std::ptrdiff_t mask;
+        std::unique_ptr<std::atomic<Task *>[]> tasks;
+
+        explicit _Buffer(std::ptrdiff_t size) :
+            mask{size - 1}, tasks{new std::atomic<Task *>[size]} {}
+
+        Task *get(std::ptrdiff_t i) const noexcept {
+            return tasks[i & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(std::ptrdiff_t i, Task *task) noexcept {
+            tasks[i & mask].store(task, std::memory_order_relaxed);
+        }
+    };
+
+    // Padding rather than alignas, which C++14's operator new can't honour,
+    // keeps thieves' writes to _top off the owner's line for _bottom.
+    std::atomic<std::ptrdiff_t> _top;
+    char _pad[64 - sizeof(std::atomic<std::ptrdiff_t>)];
+    std::atomic<std::ptrdiff_t> _bottom;
+    std::atomic<_Buffer *> _buffer;
+    std::vector<std::unique_ptr<_Buffer>> _buffers;
+
+    _Buffer *_grow(_Buffer *buffer, std::ptrdiff_t top, std::ptrdiff_t bottom) {
+        _buffers.emplace_back(new _Buffer{2 * (buffer->mask + 1)});
+        auto grown = _buffers.back().get();
+        for (auto i = top; i < bottom; i++) grown->put(i, buffer->get(i));
+        _buffer.store(grown, std::memory_order_release);
+        return grown;
+    }
+
+public:
+    WorkDeque() : _top{0}, _bottom{0} {
+        _buffers.emplace_back(new _Buffer{64});
+        _buffer.store(_buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    // Only the owner may push or take.
+    void push(Task *task) {
+        auto bottom = _bottom.load(std::memory_order_relaxed);
+        auto top = _top.load(std::memory_order_acquire);
+        auto buffer = _buffer.load(std::memory_order_relaxed);
+        if (bottom - top > buffer->mask) buffer = _grow(buffer, top, bottom);
+        buffer->put(bottom, task);
+        _bottom.store(bottom + 1, std::memory_order_release);
+    }
+
+    Task *take() noexcept {
+        auto bottom = _bottom.load(std::memory_order_relaxed) - 1;
+        auto buffer = _buffer.load(std::memory_order_relaxed);
+        _bottom.store(bottom, std::memory_order_seq_cst);
+        auto top = _top.load(std::memory_order_seq_cst);
+        if (top > bottom) {
+            _bottom.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        auto task = buffer->get(bottom);
+        if (top == bottom) {
+            // The last task: race any thieves for it.
+            if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed)) {
+                task = nullptr;
+            }
+            _bottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+
+    // Sets aborted if it lost a race, when the deque may not be empty.
+    Task *steal(bool &aborted) noexcept {
+        auto top = _top.load(std::memory_order_seq_cst);
+        auto bottom = _bottom.load(std::memory_order_seq_cst);
+        if (top >= bottom) return nullptr;
+        auto task = _buffer.load(std::memory_order_acquire)->get(top);
+        if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            aborted = true;
+            return nullptr;
+        }
+        return task;
+    }
+}; // class WorkDeque
+}
+
+// Waits for the tasks of one submit() or submit_batch() call.
+class Completion {
+    friend class ThreadPool;
+
+    SharedPtr<internal::TaskState> _state;
+
+    explicit Completion(SharedPtr<internal::TaskState> state) noexcept :
+        _state{std::move(state)} {}
+
+public:
+    bool done() const noexcept {
+        return _state->done();
+    }
+
+    // Rethrows the first exception a task threw. A task waiting on other
+    // tasks should use ThreadPool::wait() instead, which runs them meanwhile.
+    void wait() const {
+        _state->wait();
+    }
+}; // class Completion
+
+// Runs Function<void()> tasks on a fixed set of workers. Each worker keeps its
+// own deque of tasks, so tasks submitted by a running task stay on its worker
+// unless an idle worker steals them from a randomly chosen victim. Tasks
+// submitted from other threads go through a shared injection queue.
+class ThreadPool {
+    struct _Worker {
+        ThreadPool *pool;
+        internal::WorkDeque deque;
+        std::uint32_t seed;
+    };
+
+    std::vector<std::unique_ptr<_Worker>> _workers;
+    std::mutex _lock;
+    std::condition_variable _wake;
+    std::deque<internal::Task *> _injected;
+    std::atomic_size_t _injected_count;
+    std::atomic_size_t _epoch;
+    std::atomic_size_t _sleeping;
+    bool _stopping = false;
+    std::vector<std::thread> _threads;
+
+    static _Worker *&_current() noexcept {
+        thread_local _Worker *current = nullptr;
+        return current;
+    }
+
+    _Worker *_self() const noexcept {
+        auto current = _current();
+        return current && current->pool == this ? current : nullptr;
+    }
+
+    static std::uint32_t _random(_Worker &worker) noexcept {
+        auto x = worker.seed;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return worker.seed = x;
+    }
+
+    internal::Task *_take_injected() {
+        if (!_injected_count.load(std::memory_order_acquire)) return nullptr;
+        std::lock_guard<std::mutex> guard{_lock};
+        if (_injected.empty()) return nullptr;
+        auto task = _injected.front();
+        _injected.pop_front();
+        _injected_count.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+    }
+
+    internal::Task *_steal(_Worker &thief) noexcept {
+        auto count = _workers.size();
+        for (;;) {
+            bool aborted = false;
+            auto start = _random(thief) % count;
+            for (std::size_t i = 0; i < count; i++) {
+                auto &victim = *_workers[(start + i) % count];
+                if (&victim == &thief) continue;
+                if (auto task = victim.deque.steal(aborted)) return task;
+            }
+            if (!aborted) return nullptr;
+        }
+    }
+
+    internal::Task *_find(_Worker &worker) {
+        if (auto task = worker.deque.take()) return task;
+        if (auto task = _take_injected()) return task;
+        return _steal(worker);
+    }
+
+    static void _run(internal::Task *task) noexcept {
+        try {
+            task->function();
+        } catch (...) {
+            task->state->fail(std::current_exception());
+        }
+        task->state->finish();
+        delete task;
+    }
+
+    // Wakes a worker for each of count new tasks, as far as there are any asleep.
+    void _notify(std::size_t count) {
+        // A read-modify-write, unlike a load, can't miss a worker that has
+        // just announced it is going to sleep.
+        auto sleeping = _sleeping.fetch_add(0, std::memory_order_acq_rel);
+        if (!sleeping) return;
+        {
+            std::lock_guard<std::mutex> guard{_lock};
+            _epoch.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (count >= sleeping) {
+            _wake.notify_all();
+        } else {
+            while (count--) _wake.notify_one();
+        }
+    }
+
+    void _work(_Worker &worker) {
+        _current() = &worker;
+        for (;;) {
+            auto epoch = _epoch.load(std::memory_order_acquire);
+            if (auto task = _find(worker)) {
+                _run(task);
+                continue;
+            }
+            // Announce the nap, then look once more: a submitter either sees
+            // us sleeping and bumps the epoch, or we see its task here.
+            _sleeping.fetch_add(1, std::memory_order_acq_rel);
+            if (auto task = _find(worker)) {
+                _sleeping.fetch_sub(1, std::memory_order_relaxed);
+                _run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> guard{_lock};
+            _wake.wait(guard, [&] {
+                return _stopping || _epoch.load(std::memory_order_relaxed) != epoch;
+            });
+            _sleeping.fetch_sub(1, std::memory_order_relaxed);
+            if (_stopping && _injected.empty()) {
+                guard.unlock();
+                // Drain anything still queued on a worker before leaving.
+                while (auto task = _find(worker)) _run(task);
+                return;
+            }
+        }
+    }
+
+    // Each task is released only once a queue holds it, so if pushing throws,
+    // the caller still owns the rest.
+    void _push(std::unique_ptr<internal::Task> *tasks, std::size_t count) {
+        if (auto self = _self()) {
+            for (std::size_t i = 0; i < count; i++) {
+                self->deque.push(tasks[i].get());
+                tasks[i].release();
+            }
+        } else {
+            std::lock_guard<std::mutex> guard{_lock};
+            for (std::size_t i = 0; i < count; i++) {
+                _injected.push_back(tasks[i].get());
+                tasks[i].release();
+                _injected_count.fetch_add(1, std::memory_order_release);
+            }
+        }
+        _notify(count);
+    }
+
+public:
+    explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency()) :
+        _injected_count{0}, _epoch{0}, _sleeping{0} {
+        if (!threads) threads = 1;
+        for (std::size_t i = 0; i < threads; i++) {
+            _workers.emplace_back(new _Worker{this, {}, std::uint32_t(2654435761u * (i + 1))});
+        }
+        for (auto &worker : _workers) {
+            auto w = worker.get();
+            _threads.emplace_back([this, w] { _work(*w); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Every task submitted so far runs before this returns.
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard{_lock};
+            _stopping = true;
+        }
+        _wake.notify_all();
+        for (auto &thread : _threads) thread.join();
+    }
+
+    std::size_t size() const noexcept {
+        return _workers.size();
+    }
+
+    template <typename F>
+    Completion submit(F &&f) {
+        auto state = MakeShared<internal::TaskState>(1);
+        std::unique_ptr<internal::Task> task{
+            new internal::Task{Function<void()>{std::forward<F>(f)}, state}};
+        _push(&task, 1);
+        return Completion{std::move(state)};
+    }
+
+    // Submits a task for each element of [first, last), with one Completion
+    // for all of them. Pass move iterators to move the elements in.
+    template <typename It>
+    Completion submit_batch(It first, It last) {
+        std::vector<std::unique_ptr<internal::Task>> tasks;
+        for (; first != last; ++first) {
+            std::unique_ptr<internal::Task> task{new internal::Task{Function<void()>{*first}, {}}};
+            tasks.push_back(std::move(task));
+        }
+        auto state = MakeShared<internal::TaskState>(tasks.size());
+        for (auto &task : tasks) task->state = state;
+        if (!tasks.empty()) _push(tasks.data(), tasks.size());
+        return Completion{std::move(state)};
+    }
+
+    // Called from a worker, runs other tasks until the completion is done,
+    // so a task can wait on tasks it submitted without tying up its worker.
+    void wait(const Completion &completion) {
+        if (auto self = _self()) {
+            while (!completion.done()) {
+                if (auto task = _find(*self)) {
+                    _run(task);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        completion.wait();
+    }
+}; // class ThreadPool
+}
+
+#endif // CS540_THREAD_POOL_HPP
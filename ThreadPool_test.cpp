@@ -0,0 +1,240 @@
+#include "ThreadPool.hpp"
+#include <iostream>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+//The pool fan-out/fan-in request handling used before: one locked queue
+//shared by every worker, with waiting tasks helping to drain it
+class locked_pool {
+  std::mutex _lock;
+  std::condition_variable _ready;
+  std::deque<cs540::Function<void()>> _queue;
+  bool _stopping = false;
+  std::vector<std::thread> _threads;
+
+  bool _try_run() {
+    std::unique_lock<std::mutex> guard(_lock);
+    if (_queue.empty()) {
+      return false;
+    }
+    auto task = std::move(_queue.front());
+    _queue.pop_front();
+    guard.unlock();
+    task();
+    return true;
+  }
+
+public:
+  explicit locked_pool(int threads) {
+    for (int i = 0; i < threads; i++) {
+      _threads.emplace_back([this]() {
+        std::unique_lock<std::mutex> guard(_lock);
+        for (;;) {
+          _ready.wait(guard, [this]() { return _stopping || !_queue.empty(); });
+          if (_queue.empty()) {
+            return;
+          }
+          auto task = std::move(_queue.front());
+          _queue.pop_front();
+          guard.unlock();
+          task();
+          guard.lock();
+        }
+      });
+    }
+  }
+  ~locked_pool() {
+    {
+      std::lock_guard<std::mutex> guard(_lock);
+      _stopping = true;
+    }
+    _ready.notify_all();
+    for (auto &t : _threads) {
+      t.join();
+    }
+  }
+  void submit(cs540::Function<void()> task) {
+    {
+      std::lock_guard<std::mutex> guard(_lock);
+      _queue.push_back(std::move(task));
+    }
+    _ready.notify_one();
+  }
+  void wait(const std::atomic<int> &remaining) {
+    while (remaining.load()) {
+      if (!_try_run()) {
+        std::this_thread::yield();
+      }
+    }
+  }
+};
+
+//A functor whose copies throw when n is 2
+struct throwing_copy_t {
+  static std::atomic<int> live;
+  int n;
+  explicit throwing_copy_t(int n) : n(n) { ++live; }
+  throwing_copy_t(const throwing_copy_t &that) : n(that.n) {
+    if (n == 2) {
+      throw std::runtime_error("copy failed");
+    }
+    ++live;
+  }
+  ~throwing_copy_t() { --live; }
+  void operator()() {}
+};
+
+std::atomic<int> throwing_copy_t::live(0);
+
+const int REQUESTS = 2000;
+const int FAN_OUT = 16;
+
+//Handles REQUESTS requests that each fan out to FAN_OUT subtasks and wait
+//for them, returning requests per second
+double handle_requests(cs540::ThreadPool &pool, std::atomic<long> &sum) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<cs540::Function<void()>> requests;
+  for (int r = 0; r < REQUESTS; r++) {
+    requests.push_back([&pool, &sum]() {
+      std::vector<cs540::Function<void()>> subtasks;
+      for (int i = 0; i < FAN_OUT; i++) {
+        subtasks.push_back([&sum, i]() { sum.fetch_add(i, std::memory_order_relaxed); });
+      }
+      pool.wait(pool.submit_batch(std::make_move_iterator(subtasks.begin()),
+                                   std::make_move_iterator(subtasks.end())));
+    });
+  }
+  pool.submit_batch(requests.begin(), requests.end()).wait();
+  auto end = std::chrono::steady_clock::now();
+  return REQUESTS / std::chrono::duration<double>(end - start).count();
+}
+
+double handle_requests(locked_pool &pool, std::atomic<long> &sum) {
+  auto start = std::chrono::steady_clock::now();
+  std::atomic<int> requests(REQUESTS);
+  for (int r = 0; r < REQUESTS; r++) {
+    pool.submit([&pool, &sum, &requests]() {
+      std::atomic<int> remaining(FAN_OUT);
+      for (int i = 0; i < FAN_OUT; i++) {
+        pool.submit([&sum, &remaining, i]() {
+          sum.fetch_add(i, std::memory_order_relaxed);
+          --remaining;
+        });
+      }
+      pool.wait(remaining);
+      --requests;
+    });
+  }
+  pool.wait(requests);
+  auto end = std::chrono::steady_clock::now();
+  return REQUESTS / std::chrono::duration<double>(end - start).count();
+}
+
+int main(void) {
+  {
+    //Test submitting from outside the pool
+    cs540::ThreadPool pool(4);
+    assert(pool.size() == 4);
+    std::atomic<int> ran(0);
+    auto completion = pool.submit([&ran]() { ++ran; });
+    completion.wait();
+    assert(completion.done() && ran == 1);
+
+    //Test a batch shares one completion
+    std::vector<cs540::Function<void()>> tasks(100, [&ran]() { ++ran; });
+    pool.submit_batch(tasks.begin(), tasks.end()).wait();
+    assert(ran == 101);
+
+    //Test an empty batch is already done
+    assert(pool.submit_batch(tasks.end(), tasks.end()).done());
+  }
+
+  {
+    //Test tasks submitting and waiting on tasks, deeper than there are workers
+    cs540::ThreadPool pool(2);
+    std::atomic<int> leaves(0);
+    cs540::Function<void(int)> tree;
+    tree = [&pool, &leaves, &tree](int depth) {
+      if (!depth) {
+        ++leaves;
+        return;
+      }
+      auto left = pool.submit([&tree, depth]() { tree(depth - 1); });
+      auto right = pool.submit([&tree, depth]() { tree(depth - 1); });
+      pool.wait(left);
+      pool.wait(right);
+    };
+    pool.submit([&tree]() { tree(10); }).wait();
+    assert(leaves == 1024);
+  }
+
+  {
+    //Test an exception reaches the waiter
+    cs540::ThreadPool pool(2);
+    auto completion = pool.submit([]() { throw std::runtime_error("task failed"); });
+    try {
+      completion.wait();
+      assert(false);
+    } catch (const std::runtime_error &e) {
+      assert(std::string(e.what()) == "task failed");
+    }
+  }
+
+  {
+    //Test tasks made before a failed copy are not leaked
+    cs540::ThreadPool pool(2);
+    {
+      std::vector<throwing_copy_t> functors;
+      for (int i = 0; i < 4; i++) {
+        functors.emplace_back(i);
+      }
+      try {
+        pool.submit_batch(functors.begin(), functors.end());
+        assert(false);
+      } catch (const std::runtime_error &) {
+      }
+    }
+    assert(throwing_copy_t::live == 0);
+  }
+
+  {
+    //Test every submitted task runs before the pool is destroyed
+    std::atomic<int> ran(0);
+    {
+      cs540::ThreadPool pool(3);
+      for (int i = 0; i < 1000; i++) {
+        pool.submit([&ran]() { ++ran; });
+      }
+    }
+    assert(ran == 1000);
+  }
+
+  {
+    //Benchmark fan-out/fan-in requests per second from 1 to 64 threads
+    long expected = long(REQUESTS) * FAN_OUT * (FAN_OUT - 1) / 2;
+    for (int threads = 1; threads <= 64; threads *= 2) {
+      std::atomic<long> stealing_sum(0), locked_sum(0);
+      double stealing, locked;
+      {
+        cs540::ThreadPool pool(threads);
+        stealing = handle_requests(pool, stealing_sum);
+      }
+      {
+        locked_pool pool(threads);
+        locked = handle_requests(pool, locked_sum);
+      }
+      assert(stealing_sum == expected && locked_sum == expected);
+      std::cout << threads << " threads: work stealing=" << stealing
+                << " requests/sec, locked queue=" << locked << " requests/sec" << std::endl;
+    }
+  }
+}